@@ -1,6 +1,11 @@
 #include "DatProcessor.h"
 #include "HAL/PlatformFilemanager.h"  
 #include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Wil21ChunkedDataset.h"
+#include "Wil21DatasetIndex.h"
+#include "Wil21Memory.h"
+#include "Wil21Spectrum.h"
   
 
 double UWil21BlueprintLibrary::DoubleFromHalf(uint16 Half)  
@@ -23,45 +28,47 @@ double UWil21BlueprintLibrary::DoubleFromHalf(uint16 Half)
     return Out;  
 }
 
-void UWil21BlueprintLibrary::ReadRadianceFile(IFileHandle* Handle, double SingleVisibility, FRadianceData& Result)
+int UWil21BlueprintLibrary::SelectBracket(const TArray<double>& ValuesInFile, bool bSelect, double Query, TArray<double>& OutSelected)
+{
+    OutSelected.Reset();
+    if (!bSelect || ValuesInFile.Num() <= 1)
+    {
+        OutSelected = ValuesInFile;
+        return 0;
+    }
+    if (Query <= ValuesInFile[0])
+    {
+        OutSelected.Add(ValuesInFile[0]);
+        return 0;
+    }
+    if (Query >= ValuesInFile.Last())
+    {
+        OutSelected.Add(ValuesInFile.Last());
+        return ValuesInFile.Num() - 1;
+    }
+    int Idx = 0;
+    while (Query >= ValuesInFile[Idx])
+    {
+        ++Idx;
+    }
+    OutSelected.Add(ValuesInFile[Idx - 1]);
+    OutSelected.Add(ValuesInFile[Idx]);
+    return Idx - 1;
+}
+
+bool UWil21BlueprintLibrary::ReadRadianceHeader(IFileHandle* Handle, FRadianceData& Result)
 {
     // Read metadata  
     int VisibilityCount = 0;  
-    Handle->Read((uint8*)&VisibilityCount, sizeof(int));  
+    if (!Handle->Read((uint8*)&VisibilityCount, sizeof(int)) || VisibilityCount < 1)
+    {
+        UE_LOG(LogTemp, Error, TEXT("Invalid visibility count"));
 
-    TArray<double> VisibilitiesRadInFile;  
-    VisibilitiesRadInFile.SetNum(VisibilityCount);  
-    Handle->Read((uint8*)VisibilitiesRadInFile.GetData(), sizeof(double) * VisibilityCount);  
+        return false;
+    }
 
-    // Process visibilities similar to the original function  
-    int SkippedVisibilities = 0;  
-    if (SingleVisibility <= 0.0 || VisibilityCount <= 1)  
-    {  
-        Result.VisibilitiesRad = VisibilitiesRadInFile;  
-    }  
-    else  
-    {  
-        if (SingleVisibility <= VisibilitiesRadInFile[0])  
-        {  
-            Result.VisibilitiesRad.Add(VisibilitiesRadInFile[0]);  
-        }  
-        else if (SingleVisibility >= VisibilitiesRadInFile.Last())  
-        {  
-            Result.VisibilitiesRad.Add(VisibilitiesRadInFile.Last());  
-            SkippedVisibilities = VisibilitiesRadInFile.Num() - 1;  
-        }  
-        else  
-        {  
-            int VisIdx = 0;  
-            while (SingleVisibility >= VisibilitiesRadInFile[VisIdx])  
-            {  
-                ++VisIdx;  
-            }  
-            Result.VisibilitiesRad.Add(VisibilitiesRadInFile[VisIdx - 1]);  
-            Result.VisibilitiesRad.Add(VisibilitiesRadInFile[VisIdx]);  
-            SkippedVisibilities = VisIdx - 1;  
-        } 
-    }  
+    Result.VisibilitiesInFile.SetNum(VisibilityCount);  
+    Handle->Read((uint8*)Result.VisibilitiesInFile.GetData(), sizeof(double) * VisibilityCount);  
 
     // Read other metadata  
     int AlbedoCount = 0;  
@@ -76,11 +83,11 @@ void UWil21BlueprintLibrary::ReadRadianceFile(IFileHandle* Handle, double Single
     {  
         UE_LOG(LogTemp, Error, TEXT("Invalid altitude count"));
 
-        return;
+        return false;
     }  
 
-    Result.AltitudesRad.SetNum(AltitudeCount);  
-    Handle->Read((uint8*)Result.AltitudesRad.GetData(), sizeof(double) * AltitudeCount);  
+    Result.AltitudesInFile.SetNum(AltitudeCount);  
+    Handle->Read((uint8*)Result.AltitudesInFile.GetData(), sizeof(double) * AltitudeCount);  
 
     int ElevationCount = 0;  
     Handle->Read((uint8*)&ElevationCount, sizeof(int));  
@@ -88,7 +95,7 @@ void UWil21BlueprintLibrary::ReadRadianceFile(IFileHandle* Handle, double Single
     {  
         UE_LOG(LogTemp, Error, TEXT("Invalid elevation count"));
 
-        return;
+        return false;
     }  
 
     Result.ElevationsRad.SetNum(ElevationCount);  
@@ -99,7 +106,7 @@ void UWil21BlueprintLibrary::ReadRadianceFile(IFileHandle* Handle, double Single
     {  
         UE_LOG(LogTemp, Error, TEXT("Invalid channel count"));
 
-        return;
+        return false;
     }  
 
     Handle->Read((uint8*)&Result.ChannelStart, sizeof(double));  
@@ -107,7 +114,7 @@ void UWil21BlueprintLibrary::ReadRadianceFile(IFileHandle* Handle, double Single
     {  
         UE_LOG(LogTemp, Error, TEXT("Invalid channel start"));
 
-        return;
+        return false;
     }  
 
     Handle->Read((uint8*)&Result.ChannelWidth, sizeof(double));  
@@ -115,24 +122,16 @@ void UWil21BlueprintLibrary::ReadRadianceFile(IFileHandle* Handle, double Single
     {  
         UE_LOG(LogTemp, Error, TEXT("Invalid channel width"));
 
-        return;
+        return false;
     }  
     
-    // Calculate totalConfigs, skippedConfigsBegin, skippedConfigsEnd  
-    int TotalConfigs = Result.Channels * Result.ElevationsRad.Num() * Result.AltitudesRad.Num() * Result.AlbedosRad.Num() * Result.VisibilitiesRad.Num();  
-
-    int SkippedConfigsBegin = Result.Channels * Result.ElevationsRad.Num() * Result.AltitudesRad.Num() * Result.AlbedosRad.Num() * SkippedVisibilities;  
-
-    int SkippedConfigsEnd = Result.Channels * Result.ElevationsRad.Num() * Result.AltitudesRad.Num() * Result.AlbedosRad.Num() *   
-        (VisibilitiesRadInFile.Num() - SkippedVisibilities - Result.VisibilitiesRad.Num());  
-
     // Read sun, zenith, and emph breaks  
     Handle->Read((uint8*)&Result.MetadataRad.Rank, sizeof(int));  
     if (Result.MetadataRad.Rank < 1)  
     {  
         UE_LOG(LogTemp, Error, TEXT("Invalid rank"));
 
-        return;
+        return false;
     }  
 
     int SunBreaksCount = 0;  
@@ -141,7 +140,7 @@ void UWil21BlueprintLibrary::ReadRadianceFile(IFileHandle* Handle, double Single
     {  
         UE_LOG(LogTemp, Error, TEXT("Invalid sun breaks count"));
 
-        return;
+        return false;
     }  
 
     Result.MetadataRad.SunBreaks.SetNum(SunBreaksCount);  
@@ -153,7 +152,7 @@ void UWil21BlueprintLibrary::ReadRadianceFile(IFileHandle* Handle, double Single
     {  
         UE_LOG(LogTemp, Error, TEXT("Invalid zenith breaks count"));
 
-        return;
+        return false;
     }  
 
     Result.MetadataRad.ZenithBreaks.SetNum(ZenithBreaksCount);  
@@ -165,214 +164,513 @@ void UWil21BlueprintLibrary::ReadRadianceFile(IFileHandle* Handle, double Single
     {  
         UE_LOG(LogTemp, Error, TEXT("Invalid emph breaks count"));
 
-        return;
+        return false;
     }  
 
     Result.MetadataRad.EmphBreaks.SetNum(EmphBreaksCount);  
     Handle->Read((uint8*)Result.MetadataRad.EmphBreaks.GetData(), sizeof(double) * EmphBreaksCount);  
 
-    // Calculate offsets and strides  
-    Result.MetadataRad.SunOffset = 0;  
-    Result.MetadataRad.SunStride = Result.MetadataRad.SunBreaks.Num() + Result. MetadataRad.ZenithBreaks.Num();  
-
-    Result.MetadataRad.ZenithOffset = Result.MetadataRad.SunOffset + Result.MetadataRad.SunBreaks.Num();  
-    Result.MetadataRad.ZenithStride = Result.MetadataRad.SunStride;  
+    ComputeRadianceStrides(Result.MetadataRad);
 
-    Result.MetadataRad.EmphOffset = Result.MetadataRad.SunOffset + Result.MetadataRad.Rank * Result.MetadataRad.SunStride;  
+    return true;
+}
 
-    Result.MetadataRad.TotalCoefsSingleConfig = Result.MetadataRad.EmphOffset + Result.MetadataRad.EmphBreaks.Num();  
-    Result.MetadataRad.TotalCoefsAllConfigs = Result.MetadataRad.TotalCoefsSingleConfig * TotalConfigs;
+void UWil21BlueprintLibrary::ComputeRadianceStrides(FRadianceMetadata& Metadata)
+{
+    // Calculate offsets and strides  
+    Metadata.SunOffset = 0;  
+    Metadata.SunStride = Metadata.SunBreaks.Num() + Metadata.ZenithBreaks.Num();  
 
-    // Read data  
-    int Offset = 0;  
-    Result.DataRad.SetNum(Result.MetadataRad.TotalCoefsAllConfigs);  
+    Metadata.ZenithOffset = Metadata.SunOffset + Metadata.SunBreaks.Num();  
+    Metadata.ZenithStride = Metadata.SunStride;  
 
-    TArray<uint16> RadianceTemp;  
-    RadianceTemp.SetNum(FMath::Max3(Result.MetadataRad.SunBreaks.Num(), Result.MetadataRad.ZenithBreaks.Num(), Result.MetadataRad.EmphBreaks.Num()));  
+    Metadata.EmphOffset = Metadata.SunOffset + Metadata.Rank * Metadata.SunStride;  
 
-    int64 OneConfigByteCount = ((Result.MetadataRad.SunBreaks.Num() + Result.MetadataRad.ZenithBreaks.Num()) * sizeof(uint16) + sizeof(double)) * Result.MetadataRad.Rank + Result.MetadataRad.EmphBreaks.Num() * sizeof(uint16);  
+    Metadata.TotalCoefsSingleConfig = Metadata.EmphOffset + Metadata.EmphBreaks.Num();  
+    Metadata.TotalCoefsAllConfigs = 0;
+}
 
-    // Skip configurations if necessary  
-    Handle->Seek(Handle->Tell() + OneConfigByteCount * SkippedConfigsBegin);  
+void UWil21BlueprintLibrary::DecodeRadianceConfigs(const uint8* Bytes, int ConfigCount, const FRadianceMetadata& Metadata, double* Out)
+{
+    // Same layout as the file: per rank fp16 sun params, a double zenith scale and fp16 zenith params, then fp16 emphasize params
+    auto ReadHalfs = [&Bytes, &Out](int Count, double Scale)
+    {
+        for (int I = 0; I < Count; ++I)  
+        {  
+            uint16 Half;
+            FMemory::Memcpy(&Half, Bytes, sizeof(uint16));
+            Bytes += sizeof(uint16);
+            *Out++ = DoubleFromHalf(Half) / Scale;  
+        }  
+    };
 
-    // Read configurations  
-    for (int Con = 0; Con < TotalConfigs; ++Con)  
+    for (int Con = 0; Con < ConfigCount; ++Con)  
     {  
-        for (int R = 0; R < Result.MetadataRad.Rank; ++R)  
+        for (int R = 0; R < Metadata.Rank; ++R)  
         {  
-            // Read sun params  
-            Handle->Read((uint8*)RadianceTemp.GetData(), sizeof(uint16) * Result.MetadataRad.SunBreaks.Num());  
-            for (int I = 0; I < Result.MetadataRad.SunBreaks.Num(); ++I)  
-            {  
-                Result.DataRad[Offset++] = DoubleFromHalf(RadianceTemp[I]);  
-            }  
-
-            // Read zenith scale and params  
+            ReadHalfs(Metadata.SunBreaks.Num(), 1.0);
+
             double ZenithScale;  
-            Handle->Read((uint8*)&ZenithScale, sizeof(double));  
-            Handle->Read((uint8*)RadianceTemp.GetData(), sizeof(uint16) * Result.MetadataRad.ZenithBreaks.Num());  
-            for (int I = 0; I < Result.MetadataRad.ZenithBreaks.Num(); ++I)  
-            {  
-                Result.DataRad[Offset++] = DoubleFromHalf(RadianceTemp[I]) / ZenithScale;  
-            }  
+            FMemory::Memcpy(&ZenithScale, Bytes, sizeof(double));
+            Bytes += sizeof(double);
+            ReadHalfs(Metadata.ZenithBreaks.Num(), ZenithScale);
         }  
 
-        // Read emphasize params  
-        Handle->Read((uint8*)RadianceTemp.GetData(), sizeof(uint16) * Result.MetadataRad.EmphBreaks.Num());  
-        for (int I = 0; I < Result.MetadataRad.EmphBreaks.Num(); ++I)  
-        {  
-            Result.DataRad[Offset++] = DoubleFromHalf(RadianceTemp[I]);  
-        }  
+        ReadHalfs(Metadata.EmphBreaks.Num(), 1.0);
+    }
+}
+
+int64 UWil21BlueprintLibrary::GetRadianceConfigByteCount(const FRadianceMetadata& Metadata)
+{
+    return ((Metadata.SunBreaks.Num() + Metadata.ZenithBreaks.Num()) * sizeof(uint16) + sizeof(double)) * Metadata.Rank + Metadata.EmphBreaks.Num() * sizeof(uint16);
+}
+
+bool UWil21BlueprintLibrary::IsRadianceSizeSupported(int64 TotalCoefsAllConfigs, int64 RawBytes)
+{
+    const int64 DataRadBytes = TotalCoefsAllConfigs * int64(sizeof(double));
+    if (TotalCoefsAllConfigs < 0 || RawBytes < 0 || DataRadBytes > Wil21MaxDataRadBytes)
+    {
+        UE_LOG(LogTemp, Error, TEXT("Selected radiance slices decode to %lld bytes, more than the %lld the shaders can address; load fewer visibility or altitude slices"), DataRadBytes, Wil21MaxDataRadBytes);
+        return false;
+    }
+    if (TotalCoefsAllConfigs > MAX_int32 || FMath::DivideAndRoundUp<int64>(RawBytes, sizeof(uint32)) > MAX_int32)
+    {
+        UE_LOG(LogTemp, Error, TEXT("Selected radiance slices (%lld coefficients, %lld bytes) do not fit in an array"), TotalCoefsAllConfigs, RawBytes);
+        return false;
+    }
+    return true;
+}
+
+bool UWil21BlueprintLibrary::ReadRadianceFile(IFileHandle* Handle, const FWil21DatasetIndex& Index, double SingleVisibility, FRadianceData& Result, double SingleAltitude, TArray<uint32>* OutRawDataRad, bool bDecodeCoefficients)
+{
+    if (!Handle->Seek(Index.RadianceHeaderOffset) || !ReadRadianceHeader(Handle, Result))
+    {
+        return false;
+    }
+    if (Result.VisibilitiesInFile.Num() != Index.VisibilityCount || Result.AlbedosRad.Num() != Index.AlbedoCount || Result.AltitudesInFile.Num() != Index.AltitudeCount)
+    {
+        UE_LOG(LogTemp, Error, TEXT("Radiance header does not match the dataset index"));
+
+        return false;
+    }
+
+    const int SkippedVisibilities = SelectBracket(Result.VisibilitiesInFile, SingleVisibility > 0.0, SingleVisibility, Result.VisibilitiesRad);
+    // Only the altitudes bracketing SingleAltitude are kept, the full dataset is too large to hold at once
+    const int SkippedAltitudes = SelectBracket(Result.AltitudesInFile, SingleAltitude >= 0.0, SingleAltitude, Result.AltitudesRad);
+
+    const int64 TotalConfigs = int64(Index.ConfigsPerAltitude) * Result.AltitudesRad.Num() * Result.AlbedosRad.Num() * Result.VisibilitiesRad.Num();
+    const int64 TotalCoefsAllConfigs = TotalConfigs * Result.MetadataRad.TotalCoefsSingleConfig;
+    const int64 TotalBytes = TotalConfigs * Index.RadianceConfigBytes;
+    if (!IsRadianceSizeSupported(TotalCoefsAllConfigs, TotalBytes))
+    {
+        return false;
+    }
+    Result.MetadataRad.TotalCoefsAllConfigs = int32(TotalCoefsAllConfigs);
+
+    // Read data  
+    int64 Offset = 0;  
+    // The GPU expands the raw blocks itself, the doubles are only for the CPU evaluator
+    Result.DataRad.Empty();
+    if (bDecodeCoefficients)
+    {
+        Result.DataRad.SetNum(Result.MetadataRad.TotalCoefsAllConfigs);
+    }
+
+    const int ConfigCount = Index.ConfigsPerAltitude * Result.AltitudesRad.Num();
+    const int64 BlockBytes = Index.RadianceConfigBytes * ConfigCount;
+    // The blocks are kept as read, in the same order as DataRad, for the GPU to decode itself
+    TArray<uint32> RawData;
+    RawData.SetNumZeroed(FMath::DivideAndRoundUp<int64>(TotalBytes, sizeof(uint32)));
+    uint8* Block = reinterpret_cast<uint8*>(RawData.GetData());
+
+    for (int Vis = 0; Vis < Result.VisibilitiesRad.Num(); ++Vis)
+    {
+        for (int Alb = 0; Alb < Result.AlbedosRad.Num(); ++Alb)
+        {
+            // The selected altitudes of one visibility and albedo are contiguous, one seek reaches them
+            if (!Handle->Seek(Index.GetAltitudeSliceOffset(SkippedVisibilities + Vis, Alb, SkippedAltitudes)) ||
+                !Handle->Read(Block, BlockBytes))
+            {
+                UE_LOG(LogTemp, Error, TEXT("Unexpected end of file in radiance data"));
+
+                return false;
+            }
+            if (bDecodeCoefficients)
+            {
+                DecodeRadianceConfigs(Block, ConfigCount, Result.MetadataRad, Result.DataRad.GetData() + Offset);
+            }
+            Offset += int64(ConfigCount) * Result.MetadataRad.TotalCoefsSingleConfig;
+            Block += BlockBytes;
+        }
     }  
 
-    // Skip remaining configurationsHandle->Seek(Handle->Tell() + OneConfigByteCount * SkippedConfigsEnd);
+    if (OutRawDataRad)
+    {
+        *OutRawDataRad = MoveTemp(RawData);
+    }
+    return true;
 }
 
-void UWil21BlueprintLibrary::ReadTransmittanceFile(IFileHandle* FileHandle, int Channels, FTransmittanceData& Result)  
+bool UWil21BlueprintLibrary::ReadTransmittanceHeader(IFileHandle* FileHandle, FTransmittanceData& Result)  
 {
     if (!FileHandle)  
     {  
         UE_LOG(LogTemp, Error, TEXT("Invalid file handle"));  
-        return;  
+        return false;  
     }  
 
     // Read metadata  
-    int32 valsRead;  
-
-    valsRead = FileHandle->Read((uint8*)&Result.DDim, sizeof(int32));  
-    if (Result.DDim < 1)  
+    if (!FileHandle->Read((uint8*)&Result.DDim, sizeof(int32)) || Result.DDim < 1)  
     {  
         UE_LOG(LogTemp, Error, TEXT("Failed to read DDim"));  
-        return;  
+        return false;  
     }  
 
-    valsRead = FileHandle->Read((uint8*)&Result.ADim, sizeof(int32));  
-    if (Result.ADim < 1)  
+    if (!FileHandle->Read((uint8*)&Result.ADim, sizeof(int32)) || Result.ADim < 1)  
     {  
         UE_LOG(LogTemp, Error, TEXT("Failed to read ADim"));  
-        return;  
+        return false;  
     }  
 
     int32 visibilitiesCount = 0;  
-    valsRead = FileHandle->Read((uint8*)&visibilitiesCount, sizeof(int32));  
-    if ( visibilitiesCount < 1)  
+    if (!FileHandle->Read((uint8*)&visibilitiesCount, sizeof(int32)) || visibilitiesCount < 1)  
     {  
         UE_LOG(LogTemp, Error, TEXT("Failed to read visibilitiesCountTrans"));  
-        return;  
+        return false;  
     }  
 
     int32 altitudesCount = 0;  
-    valsRead = FileHandle->Read((uint8*)&altitudesCount, sizeof(int32));  
-    if ( altitudesCount < 1)  
+    if (!FileHandle->Read((uint8*)&altitudesCount, sizeof(int32)) || altitudesCount < 1)  
     {  
         UE_LOG(LogTemp, Error, TEXT("Failed to read altitudesCountTrans"));  
-        return;  
+        return false;  
     }  
 
-    valsRead = FileHandle->Read((uint8*)&Result.RankTrans, sizeof(int32));  
-    // if ( Result.RankTrans < 1)  
-    // {  
-    //     UE_LOG(LogTemp, Error, TEXT("Failed to read RankTrans"));  
-    //     return;  
-    // }  
+    if (!FileHandle->Read((uint8*)&Result.RankTrans, sizeof(int32)) || Result.RankTrans < 1)  
+    {  
+        UE_LOG(LogTemp, Error, TEXT("Failed to read RankTrans"));  
+        return false;  
+    }  
 
     TArray<float> temp;  
     temp.SetNum(FMath::Max(altitudesCount, visibilitiesCount));  
 
     Result.AltitudesTrans.SetNum(altitudesCount);  
-    valsRead = FileHandle->Read((uint8*)temp.GetData(), sizeof(float) * altitudesCount);  
-    // if (valsRead != sizeof(float) * altitudesCount)  
-    // {  
-    //     UE_LOG(LogTemp, Error, TEXT("Failed to read AltitudesTrans"));  
-    //     return;  
-    // }  
+    if (!FileHandle->Read((uint8*)temp.GetData(), sizeof(float) * altitudesCount))  
+    {  
+        UE_LOG(LogTemp, Error, TEXT("Failed to read AltitudesTrans"));  
+        return false;  
+    }  
     for (int32 i = 0; i < altitudesCount; i++)  
     {  
         Result.AltitudesTrans[i] = double(temp[i]);  
     }  
 
     Result.VisibilitiesTrans.SetNum(visibilitiesCount);  
-    valsRead = FileHandle->Read((uint8*)temp.GetData(), sizeof(float) * visibilitiesCount);  
-    // if (valsRead != sizeof(float) * visibilitiesCount)  
-    // {  
-    //     UE_LOG(LogTemp, Error, TEXT("Failed to read VisibilitiesTrans"));  
-    //     return;  
-    // }  
+    if (!FileHandle->Read((uint8*)temp.GetData(), sizeof(float) * visibilitiesCount))  
+    {  
+        UE_LOG(LogTemp, Error, TEXT("Failed to read VisibilitiesTrans"));  
+        return false;  
+    }  
     for (int32 i = 0; i < visibilitiesCount; i++)  
     {  
         Result.VisibilitiesTrans[i] = double(temp[i]);  
     }  
 
-    const int64 totalCoefsU = Result.DDim * Result.ADim * Result.RankTrans * Result.AltitudesTrans.Num();  
-    const int64 totalCoefsV = Result.VisibilitiesTrans.Num() * Result.RankTrans * Channels * Result.AltitudesTrans.Num();  
+    return true;
+}
+
+bool UWil21BlueprintLibrary::ReadTransmittanceFile(IFileHandle* FileHandle, const FWil21DatasetIndex& Index, int Channels, FTransmittanceData& Result)  
+{
+    if (!FileHandle || !Index.HasTransmittance())  
+    {  
+        UE_LOG(LogTemp, Error, TEXT("Dataset has no transmittance block"));  
+        return false;  
+    }  
+
+    if (!FileHandle->Seek(Index.TransmittanceHeaderOffset) || !ReadTransmittanceHeader(FileHandle, Result))
+    {
+        return false;
+    }
+
+    const int64 totalCoefsU = int64(Result.DDim) * Result.ADim * Result.RankTrans * Result.AltitudesTrans.Num();  
+    const int64 totalCoefsV = int64(Result.VisibilitiesTrans.Num()) * Result.RankTrans * Channels * Result.AltitudesTrans.Num();  
+
+    // Guard against a corrupt header asking for more data than the file holds
+    const int64 Remaining = FileHandle->Size() - FileHandle->Tell();
+    if ((totalCoefsU + totalCoefsV) * int64(sizeof(float)) > Remaining)
+    {
+        UE_LOG(LogTemp, Error, TEXT("Transmittance block needs %lld bytes but only %lld remain"), (totalCoefsU + totalCoefsV) * int64(sizeof(float)), Remaining);
+        return false;
+    }
 
     // Read data  
     Result.DataTransU.SetNum(totalCoefsU);  
-    valsRead = FileHandle->Read((uint8*)Result.DataTransU.GetData(), sizeof(float) * totalCoefsU);  
-    // if (valsRead != sizeof(float) * totalCoefsU)  
-    // {  
-    //     UE_LOG(LogTemp, Error, TEXT("Failed to read DataTransU"));  
-    //     return;  
-    // }  
+    if (!FileHandle->Read((uint8*)Result.DataTransU.GetData(), sizeof(float) * totalCoefsU))  
+    {  
+        UE_LOG(LogTemp, Error, TEXT("Failed to read DataTransU"));  
+        return false;  
+    }  
 
     Result.DataTransV.SetNum(totalCoefsV);  
-    valsRead = FileHandle->Read((uint8*)Result.DataTransV.GetData(), sizeof(float) * totalCoefsV);  
-    // if (valsRead != sizeof(float) * totalCoefsV)  
-    // {  
-    //     UE_LOG(LogTemp, Error, TEXT("Failed to read DataTransV"));  
-    //     return;  
-    // }  
-    
+    if (!FileHandle->Read((uint8*)Result.DataTransV.GetData(), sizeof(float) * totalCoefsV))  
+    {  
+        UE_LOG(LogTemp, Error, TEXT("Failed to read DataTransV"));  
+        return false;  
+    }  
+
+    return true;
 }
 
-FShaderPackedData UWil21BlueprintLibrary::ReadDatFileFromContentFolder(FSkyModelData& SkyModelData, const FString& FileName, double SingleVisibility)  
+FString UWil21BlueprintLibrary::GetDatasetPath(const FString& FileName)
+{
+    const FString FilePath = FPaths::Combine(FPaths::ProjectPluginsDir(), TEXT("Wil21Model"), TEXT("Content"), FileName);
+    // Deployments may ship only the compressed container (Wil21.CompressDataset) under the same name
+    const FString ChunkedPath = FPaths::ChangeExtension(FilePath, TEXT("w21c"));
+    if (!FPaths::FileExists(FilePath) && FPaths::FileExists(ChunkedPath))
+    {
+        return ChunkedPath;
+    }
+    return FilePath;
+}
+
+bool UWil21BlueprintLibrary::ReadTransmittanceFromContentFolder(const FString& FileName, int Channels, FTransmittanceData& Result)
+{
+    FString FilePath = GetDatasetPath(FileName);
+    if (FWil21ChunkedDataset::IsChunkedDataset(FilePath))
+    {
+        FWil21ChunkedDataset Dataset;
+        if (!FWil21ChunkedDataset::Open(FilePath, Dataset) || !Dataset.ReadTransmittance(Channels, Result))
+        {
+            UE_LOG(LogTemp, Warning, TEXT("Failed to read transmittance data: %s"), *FilePath);
+            Result = FTransmittanceData();
+            return false;
+        }
+        return true;
+    }
+    TUniquePtr<IFileHandle> Handle(FPlatformFileManager::Get().GetPlatformFile().OpenRead(*FilePath));
+    FWil21DatasetIndex Index;
+    if (!Handle || !FWil21DatasetIndex::LoadOrBuild(FilePath, Handle.Get(), Index))
+    {
+        UE_LOG(LogTemp, Error, TEXT("Failed to open file: %s"), *FilePath);
+        return false;
+    }
+    if (!ReadTransmittanceFile(Handle.Get(), Index, Channels, Result))
+    {
+        UE_LOG(LogTemp, Warning, TEXT("Failed to read transmittance data: %s"), *FilePath);
+        Result = FTransmittanceData();
+        return false;
+    }
+    return true;
+}
+
+FShaderPackedData UWil21BlueprintLibrary::ReadDatFileFromContentFolder(FSkyModelData& SkyModelData, const FString& FileName, double SingleVisibility, double SingleAltitude, bool bLoadTransmittance, bool bDecodeCoefficients)  
 {  
-    FString FilePath = FPaths::Combine(FPaths::ProjectPluginsDir(), TEXT("Wil21Model"), TEXT("Content"), FileName);
+    LLM_SCOPE_BYTAG(Wil21Model);
+    FString FilePath = GetDatasetPath(FileName);
+    FShaderPackedData ShaderPackedData;
+    if (FWil21ChunkedDataset::IsChunkedDataset(FilePath))
+    {
+        FWil21ChunkedDataset Dataset;
+        TArray<uint32> RawDataRad;
+        if (!FWil21ChunkedDataset::Open(FilePath, Dataset) ||
+            !Dataset.ReadRadiance(SingleVisibility, SingleAltitude, SkyModelData.RadianceData, &RawDataRad, bDecodeCoefficients))
+        {
+            UE_LOG(LogTemp, Error, TEXT("Failed to read radiance data: %s"), *FilePath);
+            return ShaderPackedData;
+        }
+        if (bLoadTransmittance && !Dataset.ReadTransmittance(SkyModelData.RadianceData.Channels, SkyModelData.TransmittanceData))
+        {
+            UE_LOG(LogTemp, Warning, TEXT("Failed to read transmittance data: %s"), *FilePath);
+            SkyModelData.TransmittanceData = FTransmittanceData();
+        }
+        return PackRadianceData(SkyModelData.RadianceData, MoveTemp(RawDataRad));
+    }
+
     IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();  
     IFileHandle* Handle = PlatformFile.OpenRead(*FilePath);  
 
     if (!Handle)  
     {  
         UE_LOG(LogTemp, Error, TEXT("Failed to open file: %s"), *FilePath);  
-        
+        return ShaderPackedData;
     }  
-    ReadRadianceFile(Handle, SingleVisibility, SkyModelData.RadianceData);
+    FWil21DatasetIndex Index;
+    TArray<uint32> RawDataRad;
+    if (!FWil21DatasetIndex::LoadOrBuild(FilePath, Handle, Index) ||
+        !ReadRadianceFile(Handle, Index, SingleVisibility, SkyModelData.RadianceData, SingleAltitude, &RawDataRad, bDecodeCoefficients))
+    {
+        UE_LOG(LogTemp, Error, TEXT("Failed to read radiance data: %s"), *FilePath);
+        delete Handle;
+        return ShaderPackedData;
+    }
     int Channels = SkyModelData.RadianceData.Channels;
-    // ReadTransmittanceFile(Handle, Channels, SkyModelData.TransmittanceData);
+    // Without transmittance the sun colour falls back to white
+    if (bLoadTransmittance && !ReadTransmittanceFile(Handle, Index, Channels, SkyModelData.TransmittanceData))
+    {
+        UE_LOG(LogTemp, Warning, TEXT("Failed to read transmittance data: %s"), *FilePath);
+        SkyModelData.TransmittanceData = FTransmittanceData();
+    }
     delete Handle;
+    return PackRadianceData(SkyModelData.RadianceData, MoveTemp(RawDataRad));
+}
+
+// uint32s of the decoded coefficient buffer, or 0 with an error when its byte offsets would not fit the shaders
+static int32 GetDataRadSize(int64 TotalCoefsAllConfigs)
+{
+    const int64 DataRadBytes = TotalCoefsAllConfigs * 2 * int64(sizeof(uint32));
+    if (DataRadBytes > Wil21MaxDataRadBytes)
+    {
+        UE_LOG(LogTemp, Error, TEXT("Decoded coefficients need %lld bytes, more than the %lld the shaders can address; load fewer visibility or altitude slices"), DataRadBytes, Wil21MaxDataRadBytes);
+        return 0;
+    }
+    return int32(TotalCoefsAllConfigs * 2);
+}
+
+FShaderPackedData UWil21BlueprintLibrary::PackRadianceData(const FRadianceData& RadianceData, TArray<uint32>&& RawDataRad)
+{
     FShaderPackedData ShaderPackedData;
-    ShaderPackedData.Rank = SkyModelData.RadianceData.MetadataRad.Rank;
-    ShaderPackedData.SunOffset = SkyModelData.RadianceData.MetadataRad.SunOffset;
-    ShaderPackedData.SunStride = SkyModelData.RadianceData.MetadataRad.SunStride;
-    ShaderPackedData.ZenithOffset = SkyModelData.RadianceData.MetadataRad.ZenithOffset;
-    ShaderPackedData.ZenithStride = SkyModelData.RadianceData.MetadataRad.ZenithStride;
-    ShaderPackedData.EmphOffset = SkyModelData.RadianceData.MetadataRad.EmphOffset;
-    ShaderPackedData.TotalCoefsSingleConfig = SkyModelData.RadianceData.MetadataRad.TotalCoefsSingleConfig;
-    ShaderPackedData.TotalCoefsAllConfigs = SkyModelData.RadianceData.MetadataRad.TotalCoefsAllConfigs;
-    ShaderPackedData.SunBreaksSize = SkyModelData.RadianceData.MetadataRad.SunBreaks.Num();
-    ShaderPackedData.ZenithBreaksSize = SkyModelData.RadianceData.MetadataRad.ZenithBreaks.Num();
-    ShaderPackedData.EmphBreaksSize = SkyModelData.RadianceData.MetadataRad.EmphBreaks.Num();
-    ShaderPackedData.VisibilitiesRadSize = SkyModelData.RadianceData.VisibilitiesRad.Num();
-    ShaderPackedData.AlbedosRadSize = SkyModelData.RadianceData.AlbedosRad.Num();
-    ShaderPackedData.AltitudesRadSize = SkyModelData.RadianceData.AltitudesRad.Num();
-    ShaderPackedData.ElevationsRadSize = SkyModelData.RadianceData.ElevationsRad.Num();
+    ShaderPackedData.Rank = RadianceData.MetadataRad.Rank;
+    ShaderPackedData.SourceRank = RadianceData.MetadataRad.Rank;
+    ShaderPackedData.SunOffset = RadianceData.MetadataRad.SunOffset;
+    ShaderPackedData.SunStride = RadianceData.MetadataRad.SunStride;
+    ShaderPackedData.ZenithOffset = RadianceData.MetadataRad.ZenithOffset;
+    ShaderPackedData.ZenithStride = RadianceData.MetadataRad.ZenithStride;
+    ShaderPackedData.EmphOffset = RadianceData.MetadataRad.EmphOffset;
+    ShaderPackedData.TotalCoefsSingleConfig = RadianceData.MetadataRad.TotalCoefsSingleConfig;
+    ShaderPackedData.TotalCoefsAllConfigs = RadianceData.MetadataRad.TotalCoefsAllConfigs;
+    ShaderPackedData.SunBreaksSize = RadianceData.MetadataRad.SunBreaks.Num();
+    ShaderPackedData.ZenithBreaksSize = RadianceData.MetadataRad.ZenithBreaks.Num();
+    ShaderPackedData.EmphBreaksSize = RadianceData.MetadataRad.EmphBreaks.Num();
+    ShaderPackedData.VisibilitiesRadSize = RadianceData.VisibilitiesRad.Num();
+    ShaderPackedData.AlbedosRadSize = RadianceData.AlbedosRad.Num();
+    ShaderPackedData.AltitudesRadSize = RadianceData.AltitudesRad.Num();
+    ShaderPackedData.ElevationsRadSize = RadianceData.ElevationsRad.Num();
+    ShaderPackedData.Channels = RadianceData.Channels;
+
+    // Channels outside the colour matching functions never reach the shader
+    const TArray<FVector3d> ChannelToRGB = Wil21Spectrum::ComputeChannelToRGB(RadianceData.Channels, RadianceData.ChannelStart, RadianceData.ChannelWidth);
+    for (int Channel = 0; Channel < ChannelToRGB.Num(); ++Channel)
+    {
+        if (!ChannelToRGB[Channel].IsZero())
+        {
+            ShaderPackedData.ChannelWeights.Add(FVector4f(FVector3f(ChannelToRGB[Channel]), float(Channel)));
+        }
+    }
+    ShaderPackedData.RankTruncationErrors = ComputeRankTruncationErrors(RadianceData, RawDataRad, ShaderPackedData.ChannelWeights);
     
 
-    ShaderPackedData.AlbedosRad = ConvertDoublesToUint32s(SkyModelData.RadianceData.AlbedosRad);
-    ShaderPackedData.AltitudesRad = ConvertDoublesToUint32s(SkyModelData.RadianceData.AltitudesRad);
-    ShaderPackedData.ElevationsRad = ConvertDoublesToUint32s(SkyModelData.RadianceData.ElevationsRad);
-    ShaderPackedData.VisibilitiesRad = ConvertDoublesToUint32s(SkyModelData.RadianceData.VisibilitiesRad);
+    ShaderPackedData.AlbedosRad = ConvertDoublesToUint32s(RadianceData.AlbedosRad);
+    ShaderPackedData.AltitudesRad = ConvertDoublesToUint32s(RadianceData.AltitudesRad);
+    ShaderPackedData.ElevationsRad = ConvertDoublesToUint32s(RadianceData.ElevationsRad);
+    ShaderPackedData.VisibilitiesRad = ConvertDoublesToUint32s(RadianceData.VisibilitiesRad);
 
     
-    ShaderPackedData.SunBreaks = ConvertDoublesToUint32s(SkyModelData.RadianceData.MetadataRad.SunBreaks);
-    ShaderPackedData.ZenithBreaks = ConvertDoublesToUint32s(SkyModelData.RadianceData.MetadataRad.ZenithBreaks);
-    ShaderPackedData.EmphBreaks = ConvertDoublesToUint32s(SkyModelData.RadianceData.MetadataRad.EmphBreaks);
-
-    ShaderPackedData.DataRad = ConvertDoublesToFUint32s(SkyModelData.RadianceData.DataRad);
-    ShaderPackedData.DataRadSize = ShaderPackedData.DataRad.Num();
+    ShaderPackedData.SunBreaks = ConvertDoublesToUint32s(RadianceData.MetadataRad.SunBreaks);
+    ShaderPackedData.ZenithBreaks = ConvertDoublesToUint32s(RadianceData.MetadataRad.ZenithBreaks);
+    ShaderPackedData.EmphBreaks = ConvertDoublesToUint32s(RadianceData.MetadataRad.EmphBreaks);
+
+    // Only the file sized configurations are uploaded, the doubles the shaders read are expanded on the GPU
+    ShaderPackedData.RawConfigBytes = GetRadianceConfigByteCount(RadianceData.MetadataRad);
+    ShaderPackedData.RawDataRad = MoveTemp(RawDataRad);
+    // From the loaded slices in 64 bits, TotalCoefsAllConfigs is only an int32
+    const int64 ConfigCount = int64(RadianceData.Channels) * RadianceData.ElevationsRad.Num() * RadianceData.AltitudesRad.Num() * RadianceData.AlbedosRad.Num() * RadianceData.VisibilitiesRad.Num();
+    ShaderPackedData.DataRadSize = GetDataRadSize(ConfigCount * RadianceData.MetadataRad.TotalCoefsSingleConfig);
     
     return ShaderPackedData;
 }
+
+TArray<float> UWil21BlueprintLibrary::ComputeRankTruncationErrors(const FRadianceData& RadianceData, const TArray<uint32>& RawDataRad, const TArray<FVector4f>& ChannelWeights)
+{
+    TArray<float> Errors;
+    const FRadianceMetadata& Metadata = RadianceData.MetadataRad;
+    const int Rank = Metadata.Rank;
+    const int CoefsPerConfig = Metadata.TotalCoefsSingleConfig;
+    const int64 ConfigBytes = GetRadianceConfigByteCount(Metadata);
+    if (Rank < 1 || CoefsPerConfig < 1 || RadianceData.Channels < 1 || ConfigBytes < 1 || RawDataRad.Num() * int64(sizeof(uint32)) < ConfigBytes)
+    {
+        return Errors;
+    }
+
+    // A configuration reconstructs the grid as sum_r Sun_r Zenith_r^T. The squared Frobenius norm of the terms from K on is
+    // sum_{r,s >= K} (Sun_r . Sun_s)(Zenith_r . Zenith_s), so suffix sums of that Gram product give every truncation at once.
+    // TailEnergy holds them per channel, K = 0 being the full reconstruction.
+    TArray<double> TailEnergy;
+    TailEnergy.SetNumZeroed(RadianceData.Channels * (Rank + 1));
+    TArray<double> Gram;
+    Gram.SetNumUninitialized(Rank * Rank);
+    // Each configuration is decoded on its own, the whole selection as doubles would be four times the raw size
+    TArray<double> Coefs;
+    Coefs.SetNumUninitialized(CoefsPerConfig);
+    const uint8* Raw = reinterpret_cast<const uint8*>(RawDataRad.GetData());
+    const int64 ConfigCount = RawDataRad.Num() * int64(sizeof(uint32)) / ConfigBytes;
+    for (int64 Config = 0; Config < ConfigCount; ++Config)
+    {
+        DecodeRadianceConfigs(Raw + Config * ConfigBytes, 1, Metadata, Coefs.GetData());
+        for (int R = 0; R < Rank; ++R)
+        {
+            for (int S = 0; S <= R; ++S)
+            {
+                double SunDot = 0.0;
+                for (int I = 0; I < Metadata.SunBreaks.Num(); ++I)
+                {
+                    SunDot += Coefs[Metadata.SunOffset + R * Metadata.SunStride + I] * Coefs[Metadata.SunOffset + S * Metadata.SunStride + I];
+                }
+                double ZenithDot = 0.0;
+                for (int I = 0; I < Metadata.ZenithBreaks.Num(); ++I)
+                {
+                    ZenithDot += Coefs[Metadata.ZenithOffset + R * Metadata.ZenithStride + I] * Coefs[Metadata.ZenithOffset + S * Metadata.ZenithStride + I];
+                }
+                Gram[R * Rank + S] = Gram[S * Rank + R] = SunDot * ZenithDot;
+            }
+        }
+
+        // Configurations are channel fastest, as in the file
+        double* Tail = &TailEnergy[(Config % RadianceData.Channels) * (Rank + 1)];
+        double Energy = 0.0;
+        for (int K = Rank - 1; K >= 0; --K)
+        {
+            Energy += Gram[K * Rank + K];
+            for (int S = K + 1; S < Rank; ++S)
+            {
+                Energy += 2.0 * Gram[K * Rank + S];
+            }
+            Tail[K] += Energy;
+        }
+    }
+
+    Errors.SetNumZeroed(Rank);
+    for (int Channel = 0; Channel < RadianceData.Channels; ++Channel)
+    {
+        const bool bActive = ChannelWeights.Num() == 0 || ChannelWeights.ContainsByPredicate([Channel](const FVector4f& Weight) { return int(Weight.W) == Channel; });
+        const double* Tail = &TailEnergy[Channel * (Rank + 1)];
+        if (!bActive || Tail[0] <= 0.0)
+        {
+            continue;
+        }
+        for (int K = 1; K <= Rank; ++K)
+        {
+            Errors[K - 1] = FMath::Max(Errors[K - 1], float(FMath::Sqrt(FMath::Max(Tail[K], 0.0) / Tail[0])));
+        }
+    }
+    return Errors;
+}
+
+void UWil21BlueprintLibrary::TruncateRank(FShaderPackedData& ShaderPackedData, int32 KeptRank)
+{
+    if (KeptRank < 1 || KeptRank >= ShaderPackedData.Rank || ShaderPackedData.TotalCoefsSingleConfig < 1)
+    {
+        return;
+    }
+    // Only the emphasize parameters move, they follow the kept rank terms
+    const int32 ConfigCount = ShaderPackedData.TotalCoefsAllConfigs / ShaderPackedData.TotalCoefsSingleConfig;
+    ShaderPackedData.Rank = KeptRank;
+    ShaderPackedData.EmphOffset = ShaderPackedData.SunOffset + KeptRank * ShaderPackedData.SunStride;
+    ShaderPackedData.TotalCoefsSingleConfig = ShaderPackedData.EmphOffset + ShaderPackedData.EmphBreaksSize;
+    ShaderPackedData.TotalCoefsAllConfigs = ShaderPackedData.TotalCoefsSingleConfig * ConfigCount;
+    ShaderPackedData.DataRadSize = GetDataRadSize(int64(ShaderPackedData.TotalCoefsSingleConfig) * ConfigCount);
+}
+
 TArray<DoublePacked> UWil21BlueprintLibrary::ConvertDoublesToUint32s(const TArray<double>& doubleArray) {  
     TArray<DoublePacked> uintArray;  
     uintArray.Reserve(doubleArray.Num()); // Reserve space for two uint32s per double  
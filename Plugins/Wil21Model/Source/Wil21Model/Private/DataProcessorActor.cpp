@@ -2,228 +2,55 @@
 
 #include "HAL/PlatformFilemanager.h"  
 #include "Misc/FileHelper.h"
+#include "Async/Async.h"
+#include "Camera/PlayerCameraManager.h"
+#include "Components/DirectionalLightComponent.h"
+#include "Engine/DirectionalLight.h"
+#include "Engine/TextureRenderTarget2DArray.h"
+#include "Kismet/GameplayStatics.h"
+#include "Wil21Geometry.h"
+#include "Wil21Memory.h"
+#include "Wil21SkyDataset.h"
+#include "Wil21Spectrum.h"
   
 
-void ADataProcessor::ReadRadianceFile(IFileHandle* Handle, double SingleVisibility, FRadianceData& Result)
-{
-    // Read metadata  
-    int VisibilityCount = 0;  
-    Handle->Read((uint8*)&VisibilityCount, sizeof(int));  
-
-    TArray<double> VisibilitiesRadInFile;  
-    VisibilitiesRadInFile.SetNum(VisibilityCount);  
-    Handle->Read((uint8*)VisibilitiesRadInFile.GetData(), sizeof(double) * VisibilityCount);  
-
-    // Process visibilities similar to the original function  
-    int SkippedVisibilities = 0;  
-    if (SingleVisibility <= 0.0 || VisibilityCount <= 1)  
-    {  
-        Result.VisibilitiesRad = VisibilitiesRadInFile;  
-    }  
-    else  
-    {  
-        if (SingleVisibility <= VisibilitiesRadInFile[0])  
-        {  
-            Result.VisibilitiesRad.Add(VisibilitiesRadInFile[0]);  
-        }  
-        else if (SingleVisibility >= VisibilitiesRadInFile.Last())  
-        {  
-            Result.VisibilitiesRad.Add(VisibilitiesRadInFile.Last());  
-            SkippedVisibilities = VisibilitiesRadInFile.Num() - 1;  
-        }  
-        else  
-        {  
-            int VisIdx = 0;  
-            while (SingleVisibility >= VisibilitiesRadInFile[VisIdx])  
-            {  
-                ++VisIdx;  
-            }  
-            Result.VisibilitiesRad.Add(VisibilitiesRadInFile[VisIdx - 1]);  
-            Result.VisibilitiesRad.Add(VisibilitiesRadInFile[VisIdx]);  
-            SkippedVisibilities = VisIdx - 1;  
-        } 
-    }  
-
-    // Read other metadata  
-    int AlbedoCount = 0;  
-    Handle->Read((uint8*)&AlbedoCount, sizeof(int));  
-    Result.AlbedosRad.SetNum(AlbedoCount);  
-    Handle->Read((uint8*)Result.AlbedosRad.GetData(), sizeof(double) * AlbedoCount);
-
-    // Read altitudes, elevations, channels, etc.  
-    int AltitudeCount = 0;  
-    Handle->Read((uint8*)&AltitudeCount, sizeof(int));  
-    if (AltitudeCount < 1)  
-    {  
-        UE_LOG(LogTemp, Error, TEXT("Invalid altitude count"));
-
-        return;
-    }  
-
-    Result.AltitudesRad.SetNum(AltitudeCount);  
-    Handle->Read((uint8*)Result.AltitudesRad.GetData(), sizeof(double) * AltitudeCount);  
-
-    int ElevationCount = 0;  
-    Handle->Read((uint8*)&ElevationCount, sizeof(int));  
-    if (ElevationCount < 1)  
-    {  
-        UE_LOG(LogTemp, Error, TEXT("Invalid elevation count"));
-
-        return;
-    }  
-
-    Result.ElevationsRad.SetNum(ElevationCount);  
-    Handle->Read((uint8*)Result.ElevationsRad.GetData(), sizeof(double) * ElevationCount);  
-
-    Handle->Read((uint8*)&Result.Channels, sizeof(int));  
-    if (Result.Channels < 1)  
-    {  
-        UE_LOG(LogTemp, Error, TEXT("Invalid channel count"));
-
-        return;
-    }  
-
-    Handle->Read((uint8*)&Result.ChannelStart, sizeof(double));  
-    if (Result.ChannelStart < 0)  
-    {  
-        UE_LOG(LogTemp, Error, TEXT("Invalid channel start"));
-
-        return;
-    }  
-
-    Handle->Read((uint8*)&Result.ChannelWidth, sizeof(double));  
-    if (Result.ChannelWidth <= 0)  
-    {  
-        UE_LOG(LogTemp, Error, TEXT("Invalid channel width"));
-
-        return;
-    }  
-    
-    // Calculate totalConfigs, skippedConfigsBegin, skippedConfigsEnd  
-    int TotalConfigs = Result.Channels * Result.ElevationsRad.Num() * Result.AltitudesRad.Num() * Result.AlbedosRad.Num() * Result.VisibilitiesRad.Num();  
-
-    int SkippedConfigsBegin = Result.Channels * Result.ElevationsRad.Num() * Result.AltitudesRad.Num() * Result.AlbedosRad.Num() * SkippedVisibilities;  
-
-    int SkippedConfigsEnd = Result.Channels * Result.ElevationsRad.Num() * Result.AltitudesRad.Num() * Result.AlbedosRad.Num() *   
-        (VisibilitiesRadInFile.Num() - SkippedVisibilities - Result.VisibilitiesRad.Num());  
-
-    // Read sun, zenith, and emph breaks  
-    Handle->Read((uint8*)&Result.MetadataRad.Rank, sizeof(int));  
-    if (Result.MetadataRad.Rank < 1)  
-    {  
-        UE_LOG(LogTemp, Error, TEXT("Invalid rank"));
-
-        return;
-    }  
-
-    int SunBreaksCount = 0;  
-    Handle->Read((uint8*)&SunBreaksCount, sizeof(int));  
-    if (SunBreaksCount < 2)  
-    {  
-        UE_LOG(LogTemp, Error, TEXT("Invalid sun breaks count"));
-
-        return;
-    }  
-
-    Result.MetadataRad.SunBreaks.SetNum(SunBreaksCount);  
-    Handle->Read((uint8*)Result.MetadataRad.SunBreaks.GetData(), sizeof(double) * SunBreaksCount);  
-
-    int ZenithBreaksCount = 0;  
-    Handle->Read((uint8*)&ZenithBreaksCount, sizeof(int));  
-    if (ZenithBreaksCount < 2)  
-    {  
-        UE_LOG(LogTemp, Error, TEXT("Invalid zenith breaks count"));
-
-        return;
-    }  
-
-    Result.MetadataRad.ZenithBreaks.SetNum(ZenithBreaksCount);  
-    Handle->Read((uint8*)Result.MetadataRad.ZenithBreaks.GetData(), sizeof(double) * ZenithBreaksCount);  
-
-    int EmphBreaksCount = 0;  
-    Handle->Read((uint8*)&EmphBreaksCount, sizeof(int));  
-    if (EmphBreaksCount < 2)  
-    {  
-        UE_LOG(LogTemp, Error, TEXT("Invalid emph breaks count"));
-
-        return;
-    }  
-
-    Result.MetadataRad.EmphBreaks.SetNum(EmphBreaksCount);  
-    Handle->Read((uint8*)Result.MetadataRad.EmphBreaks.GetData(), sizeof(double) * EmphBreaksCount);  
-
-    // Calculate offsets and strides  
-    Result.MetadataRad.SunOffset = 0;  
-    Result.MetadataRad.SunStride = Result.MetadataRad.SunBreaks.Num() + Result. MetadataRad.ZenithBreaks.Num();  
-
-    Result.MetadataRad.ZenithOffset = Result.MetadataRad.SunOffset + Result.MetadataRad.SunBreaks.Num();  
-    Result.MetadataRad.ZenithStride = Result.MetadataRad.SunStride;  
-
-    Result.MetadataRad.EmphOffset = Result.MetadataRad.SunOffset + Result.MetadataRad.Rank * Result.MetadataRad.SunStride;  
-
-    Result.MetadataRad.TotalCoefsSingleConfig = Result.MetadataRad.EmphOffset + Result.MetadataRad.EmphBreaks.Num();  
-    Result.MetadataRad.TotalCoefsAllConfigs = Result.MetadataRad.TotalCoefsSingleConfig * TotalConfigs;
-
-    // Read data  
-    int Offset = 0;  
-    Result.DataRad.SetNum(Result.MetadataRad.TotalCoefsAllConfigs);  
-
-    TArray<uint16> RadianceTemp;  
-    RadianceTemp.SetNum(FMath::Max3(Result.MetadataRad.SunBreaks.Num(), Result.MetadataRad.ZenithBreaks.Num(), Result.MetadataRad.EmphBreaks.Num()));  
-
-    int64 OneConfigByteCount = ((Result.MetadataRad.SunBreaks.Num() + Result.MetadataRad.ZenithBreaks.Num()) * sizeof(uint16) + sizeof(double)) * Result.MetadataRad.Rank + Result.MetadataRad.EmphBreaks.Num() * sizeof(uint16);  
-
-    // Skip configurations if necessary  
-    Handle->Seek(Handle->Tell() + OneConfigByteCount * SkippedConfigsBegin);  
-
-    // Read configurations  
-    for (int Con = 0; Con < TotalConfigs; ++Con)  
-    {  
-        for (int R = 0; R < Result.MetadataRad.Rank; ++R)  
-        {  
-            // Read sun params  
-            Handle->Read((uint8*)RadianceTemp.GetData(), sizeof(uint16) * Result.MetadataRad.SunBreaks.Num());  
-            for (int I = 0; I < Result.MetadataRad.SunBreaks.Num(); ++I)  
-            {  
-                Result.DataRad[Offset++] = DoubleFromHalf(RadianceTemp[I]);  
-            }  
-
-            // Read zenith scale and params  
-            double ZenithScale;  
-            Handle->Read((uint8*)&ZenithScale, sizeof(double));  
-            Handle->Read((uint8*)RadianceTemp.GetData(), sizeof(uint16) * Result.MetadataRad.ZenithBreaks.Num());  
-            for (int I = 0; I < Result.MetadataRad.ZenithBreaks.Num(); ++I)  
-            {  
-                Result.DataRad[Offset++] = DoubleFromHalf(RadianceTemp[I]) / ZenithScale;  
-            }  
-        }  
-
-        // Read emphasize params  
-        Handle->Read((uint8*)RadianceTemp.GetData(), sizeof(uint16) * Result.MetadataRad.EmphBreaks.Num());  
-        for (int I = 0; I < Result.MetadataRad.EmphBreaks.Num(); ++I)  
-        {  
-            Result.DataRad[Offset++] = DoubleFromHalf(RadianceTemp[I]);  
-        }  
-    }  
-
-    // Skip remaining configurationsHandle->Seek(Handle->Tell() + OneConfigByteCount * SkippedConfigsEnd);
-}
-
 ADataProcessor::ADataProcessor()  
 {  
     PrimaryActorTick.bCanEverTick = true;
-    ReadDatFileFromContentFolder(TEXT("SkyModelDatasetGround.dat"), 0.0);
+    // The class default object and archetypes never render, they would only keep another copy of the dataset
+    if (!HasAnyFlags(RF_ClassDefaultObject | RF_ArchetypeObject))
+    {
+        ReadDatFileFromContentFolder(TEXT("SkyModelDatasetGround.dat"), 0.0, ShaderControlData.Altitude);
+    }
     // InitializePersistentBuffer(ShaderPackedData.DataRad);
     // If render target is null, create a new black rt and init it
+    EnsureOutputRenderTarget();
+}
+
+void ADataProcessor::EnsureOutputRenderTarget()
+{
+    int32 Width = FMath::Clamp(ShaderControlData.Resolution, 16, 8192);
+    int32 Height = OutputHeight > 0 ? FMath::Clamp(OutputHeight, 8, 8192) : FMath::Max(Width / 2, 8);
+    if (ShaderControlData.bSkyViewLUT)
+    {
+        Width = FMath::Clamp(SkyViewLUTSize.X, 16, 1024);
+        Height = FMath::Clamp(SkyViewLUTSize.Y, 8, 1024);
+    }
+    // Targets assigned by the user keep their size, only the transient one created here follows Resolution
+    const bool bOwned = OutputRenderTarget && OutputRenderTarget->GetOuter() == GetTransientPackage();
+    if (OutputRenderTarget && (!bOwned || (OutputRenderTarget->SizeX == Width && OutputRenderTarget->SizeY == Height)))
+    {
+        return;
+    }
     if (!OutputRenderTarget)
     {
         OutputRenderTarget = NewObject<UTextureRenderTarget2D>();
-        OutputRenderTarget->InitCustomFormat(1024, 512, PF_FloatRGBA, false);
-        OutputRenderTarget->UpdateResourceImmediate();
     }
+    OutputRenderTarget->InitCustomFormat(Width, Height, PF_FloatRGBA, false);
+    OutputRenderTarget->UpdateResourceImmediate();
 }
 
-void ADataProcessor::ReadDatFileFromContentFolder(const FString& FileName, double SingleVisibility)  
+void ADataProcessor::ReadDatFileFromContentFolder(const FString& FileName, double SingleVisibility, double SingleAltitude)  
 {  
     FString FilePath = FPaths::Combine(FPaths::ProjectPluginsDir(), TEXT("Wil21Model"), TEXT("Content"), FileName);
     IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
@@ -233,46 +60,14 @@ void ADataProcessor::ReadDatFileFromContentFolder(const FString& FileName, doubl
         UE_LOG(LogTemp, Error, TEXT("DAT File not found: %s"), *FilePath);
         return;
     }
-    IFileHandle* Handle = PlatformFile.OpenRead(*FilePath);  
-
-    if (!Handle)  
-    {  
-        UE_LOG(LogTemp, Error, TEXT("Failed to open file: %s"), *FilePath);  
-        
-    }  
-    ReadRadianceFile(Handle, SingleVisibility, SkyModelData.RadianceData);
-    int Channels = SkyModelData.RadianceData.Channels;
-    delete Handle;
-
-    ShaderPackedData.Rank = SkyModelData.RadianceData.MetadataRad.Rank;
-    ShaderPackedData.SunOffset = SkyModelData.RadianceData.MetadataRad.SunOffset;
-    ShaderPackedData.SunStride = SkyModelData.RadianceData.MetadataRad.SunStride;
-    ShaderPackedData.ZenithOffset = SkyModelData.RadianceData.MetadataRad.ZenithOffset;
-    ShaderPackedData.ZenithStride = SkyModelData.RadianceData.MetadataRad.ZenithStride;
-    ShaderPackedData.EmphOffset = SkyModelData.RadianceData.MetadataRad.EmphOffset;
-    ShaderPackedData.TotalCoefsSingleConfig = SkyModelData.RadianceData.MetadataRad.TotalCoefsSingleConfig;
-    ShaderPackedData.TotalCoefsAllConfigs = SkyModelData.RadianceData.MetadataRad.TotalCoefsAllConfigs;
-    ShaderPackedData.SunBreaksSize = SkyModelData.RadianceData.MetadataRad.SunBreaks.Num();
-    ShaderPackedData.ZenithBreaksSize = SkyModelData.RadianceData.MetadataRad.ZenithBreaks.Num();
-    ShaderPackedData.EmphBreaksSize = SkyModelData.RadianceData.MetadataRad.EmphBreaks.Num();
-    ShaderPackedData.VisibilitiesRadSize = SkyModelData.RadianceData.VisibilitiesRad.Num();
-    ShaderPackedData.AlbedosRadSize = SkyModelData.RadianceData.AlbedosRad.Num();
-    ShaderPackedData.AltitudesRadSize = SkyModelData.RadianceData.AltitudesRad.Num();
-    ShaderPackedData.ElevationsRadSize = SkyModelData.RadianceData.ElevationsRad.Num();
-    
-
-    ShaderPackedData.AlbedosRad = ConvertDoublesToUint32s(SkyModelData.RadianceData.AlbedosRad);
-    ShaderPackedData.AltitudesRad = ConvertDoublesToUint32s(SkyModelData.RadianceData.AltitudesRad);
-    ShaderPackedData.ElevationsRad = ConvertDoublesToUint32s(SkyModelData.RadianceData.ElevationsRad);
-    ShaderPackedData.VisibilitiesRad = ConvertDoublesToUint32s(SkyModelData.RadianceData.VisibilitiesRad);
-
-    
-    ShaderPackedData.SunBreaks = ConvertDoublesToUint32s(SkyModelData.RadianceData.MetadataRad.SunBreaks);
-    ShaderPackedData.ZenithBreaks = ConvertDoublesToUint32s(SkyModelData.RadianceData.MetadataRad.ZenithBreaks);
-    ShaderPackedData.EmphBreaks = ConvertDoublesToUint32s(SkyModelData.RadianceData.MetadataRad.EmphBreaks);
-
-    ShaderPackedData.DataRad = UWil21BlueprintLibrary::ConvertDoublesToFUint32s(SkyModelData.RadianceData.DataRad);
-    ShaderPackedData.DataRadSize = ShaderPackedData.DataRad.Num();
+    // Transmittance is only read once a sun light asks for it, see EnsureSunTransmittanceLoaded
+    ShaderPackedData = UWil21BlueprintLibrary::ReadDatFileFromContentFolder(SkyModelData, FileName, SingleVisibility, SingleAltitude, false, false);
+    LoadedFileName = FileName;
+    LoadedVisibility = SingleVisibility;
+    ReleaseCpuCoefficients();
+    InitializePersistentBuffer(ShaderPackedData);
+    SunTransmittanceLUT = FWil21SunTransmittanceLUT();
+    bTransmittanceRequested = false;
      //    TArray<double> SpectralResponseData = {
      //         0.000129900000f, 0.000003917000f, 0.000606100000f,
      //         0.000232100000f, 0.000006965000f, 0.001086000000f,
@@ -373,82 +168,370 @@ void ADataProcessor::ReadDatFileFromContentFolder(const FString& FileName, doubl
 	// ShaderPackedData.SpectralResponse = UWil21BlueprintLibrary::ConvertDoublesToFUint32s(SpectralResponseData);
 }
 
-void ADataProcessor::PostInitProperties()  
-{  
-    Super::PostInitProperties();  
+void ADataProcessor::BeginPlay()
+{
+    Super::BeginPlay();
+    LoadDataset();
+    // The constructor's load ran before the flag was set, a dataset asset prepares the evaluator once its slices arrive
+    if (bPrepareCpuEvaluator && !Dataset && !TryGetCpuEvaluator().IsValid())
+    {
+        uint32 Generation = 0;
+        {
+            FScopeLock Lock(&CpuEvaluatorSlot->Lock);
+            Generation = CpuEvaluatorSlot->Generation;
+        }
+        PrepareCpuEvaluator(Generation);
+    }
+}
 
-    // 在这里进行复杂的初始化  
-    if (!HasAnyFlags(RF_ClassDefaultObject | RF_ArchetypeObject))  
-    {  
-        InitializePersistentBuffer(ShaderPackedData.DataRad);  
-    }  
+void ADataProcessor::LoadDataset()
+{
+    if (!Dataset)
+    {
+        return;
+    }
+    // Replaces whatever the constructor read from the raw file once the slices arrive
+    SunTransmittanceLUT = FWil21SunTransmittanceLUT();
+    bTransmittanceRequested = false;
+    bAltitudeStreamInFlight = true;
+    TWeakObjectPtr<ADataProcessor> WeakThis(this);
+    Dataset->LoadSlicesAsync(LoadedVisibility, ShaderControlData.Altitude, [WeakThis](FSkyModelData& NewData, FShaderPackedData& NewPacked)
+    {
+        if (ADataProcessor* This = WeakThis.Get())
+        {
+            This->OnAltitudeSlicesLoaded(NewData, NewPacked);
+        }
+    });
 }
 
-void ADataProcessor::UseRDGComputeWil21(const UObject* WorldContextObject, const FShaderPackedData& ShaderPackedDatas, const FShaderControlData& ShaderControlDatas)
+void ADataProcessor::UseRDGComputeWil21(const UObject* WorldContextObject, const FShaderPackedData& ShaderPackedDatas, const FShaderControlData& ShaderControlDatas, bool bPreview, bool bTemporal)
 {
 
     check(IsInGameThread());
     // InitializePersistentBuffer(ShaderPackedDatas.DataRad);
-    if(DataRadBuffer == nullptr)
+    if(!CoefficientBuffer.IsValid())
     {
         UE_LOG(LogTemp, Error, TEXT("DataRadBuffer is not initialized"));
         return;
     }
-    TRefCountPtr<FRDGPooledBuffer> DataRadPooledBuffers = this->DataRadPooledBuffer;
-    int32 TextureSize = 1024;
-    int32 OutputSize = TextureSize * TextureSize / 2;
-    FTexture2DRHIRef RenderTargetRHI = OutputRenderTarget->GameThread_GetRenderTargetResource()->GetRenderTargetTexture();
-    ENQUEUE_RENDER_COMMAND(CaptureCommand)
-        (
-            [ShaderPackedDatas, ShaderControlDatas, OutputSize, TextureSize, DataRadPooledBuffers, RenderTargetRHI](FRHICommandListImmediate& RHICmdList) {
-                RDGComputeWil21Buffer(RHICmdList, ShaderPackedDatas, ShaderControlDatas,
-                    OutputSize, TextureSize, DataRadPooledBuffers, RenderTargetRHI);
-            });
-}
+    if (bComputeLuminance && !LuminanceReadback.IsValid())
+    {
+        LuminanceReadback = MakeShared<FWil21LuminanceReadback, ESPMode::ThreadSafe>();
+    }
+    // A ring of another size is replaced, skies still in flight in the old one are dropped
+    if (bReadBackSky && (!SkyReadback.IsValid() || SkyReadback->RingSize != ReadbackRingSize))
+    {
+        SkyReadback = MakeShared<FWil21SkyReadback, ESPMode::ThreadSafe>(ReadbackRingSize);
+    }
+    if (!RenderScheduler.IsValid())
+    {
+        RenderScheduler = MakeShared<FWil21RenderScheduler, ESPMode::ThreadSafe>();
+    }
+    if (!TemporalHistory.IsValid())
+    {
+        TemporalHistory = MakeShared<FWil21TemporalHistory, ESPMode::ThreadSafe>();
+    }
 
+    FWil21RenderRequest Request;
+    Request.ShaderPackedData = ShaderPackedDatas;
+    Request.ShaderControlData = ShaderControlDatas;
+    Request.CoefficientBuffer = CoefficientBuffer;
+    Request.RenderTargetRHI = OutputRenderTarget->GameThread_GetRenderTargetResource()->GetRenderTargetTexture();
+    Request.LuminanceReadback = bComputeLuminance ? LuminanceReadback : nullptr;
+    Request.SkyReadback = bReadBackSky ? SkyReadback : nullptr;
+    Request.bPreview = bPreview;
+    Request.PreviewDivisor = PreviewDivisor;
+    // Every request keeps the history current, only temporal ones reuse it
+    Request.TemporalHistory = TemporalHistory;
+    Request.TemporalInterval = bTemporal ? TemporalInterval : 1;
+    Request.HistoryClampAngle = HistoryClampAngle;
+    Request.bProgressive = bProgressiveRegeneration && !bPreview && !bTemporal;
+    RenderScheduler->Request(MoveTemp(Request));
+}
 
-TArray<DoublePacked> ADataProcessor::ConvertDoublesToUint32s(const TArray<double>& doubleArray) {  
-    TArray<DoublePacked> uintArray;  
-    uintArray.Reserve(doubleArray.Num()); // Reserve space for two uint32s per double  
+void ADataProcessor::RequestSkyRender()
+{
+    // Changes closer together than PreviewSettleTime are previews, the full resolution follows once they stop.
+    // A sun that keeps moving through an unchanged atmosphere is amortised over TemporalInterval updates instead.
+    const double Now = FPlatformTime::Seconds();
+    const bool bRecent = LastControlChangeTime >= 0.0 && Now - LastControlChangeTime < PreviewSettleTime;
+    // A sky-view LUT is small enough to regenerate in full, and sun relative so the panorama reprojection does not apply
+    const bool bTemporal = bRecent && TemporalInterval > 1 && LastRequestedControl.HasSameAtmosphere(ShaderControlData) && !ShaderControlData.bSkyViewLUT;
+    const bool bChanging = bRecent && !bTemporal && bPreviewWhileChanging && !ShaderControlData.bSkyViewLUT;
+    LastControlChangeTime = Now;
+    LastRequestedControl = ShaderControlData;
+    UseRDGComputeWil21(GetWorld(), ShaderPackedData, ShaderControlData, bChanging, bTemporal);
+    if ((bChanging || bTemporal) && GetWorld())
+    {
+        GetWorld()->GetTimerManager().SetTimer(RefineTimerHandle, this, &ADataProcessor::OnControlsSettled, PreviewSettleTime, false);
+    }
+}
 
-    for (double value : doubleArray) {  
-        uint64_t doubleBits = *reinterpret_cast<const uint64_t*>(&value);
-        DoublePacked tmp;
-        tmp.Low = static_cast<uint32_t>(doubleBits & 0xFFFFFFFF);        // Lower 32 bits  
-        tmp.High = static_cast<uint32_t>((doubleBits >> 32) & 0xFFFFFFFF); // Upper 32 bits
-        uintArray.Add(tmp);
-    }  
+void ADataProcessor::OnControlsSettled()
+{
+    UseRDGComputeWil21(GetWorld(), ShaderPackedData, ShaderControlData);
+}
 
-    return uintArray;  
+void ADataProcessor::RenderSkyBatch(const TArray<FShaderControlData>& Controls, UTextureRenderTarget2DArray* OutputArray)
+{
+    check(IsInGameThread());
+    if (!CoefficientBuffer.IsValid() || !OutputArray || Controls.Num() == 0)
+    {
+        return;
+    }
+    if (Controls.Num() > OutputArray->Slices)
+    {
+        UE_LOG(LogTemp, Warning, TEXT("RenderSkyBatch: %d controls but %s only has %d slices"), Controls.Num(), *OutputArray->GetName(), OutputArray->Slices);
+    }
+    FTextureRenderTargetResource* RenderTargetResource = OutputArray->GameThread_GetRenderTargetResource();
+    ENQUEUE_RENDER_COMMAND(CaptureBatchCommand)
+        (
+            [ShaderPackedDatas = ShaderPackedData, Controls, CoefficientBuffers = CoefficientBuffer, RenderTargetResource](FRHICommandListImmediate& RHICmdList) {
+                if (!CoefficientBuffers->DataRad.IsValid() || !RenderTargetResource->GetTextureRHI())
+                {
+                    return;
+                }
+                RDGComputeWil21BatchBuffer(RHICmdList, ShaderPackedDatas, Controls, CoefficientBuffers->DataRad, RenderTargetResource->GetTextureRHI());
+            });
 }
 
-void ADataProcessor::InitializePersistentBuffer(TArray<uint32>& DataRad)  
+void ADataProcessor::InitializePersistentBuffer(FShaderPackedData& PackedData)  
 {
-    FRenderCommandFence Fence;
+    LLM_SCOPE_BYTAG(Wil21Model);
+    const int32 SourceRank = PackedData.Rank;
+    UWil21BlueprintLibrary::TruncateRank(PackedData, GetWil21KeptRank(PackedData));
+    PackedData.bDf64Coefficients = UseWil21Df64();
+    if (PackedData.Rank < SourceRank)
+    {
+        UE_LOG(LogTemp, Log, TEXT("Wil21: keeping %d of %d rank terms, %.2f%% relative error"), PackedData.Rank, SourceRank, PackedData.RankTruncationErrors[PackedData.Rank - 1] * 100.0f);
+    }
+    // A new slot per upload, so render commands queued before a slice swap keep using the buffer they were built with
+    CoefficientBuffer = MakeShared<FWil21CoefficientBuffer, ESPMode::ThreadSafe>();
+    // The raw configurations are only needed for the upload, the render thread takes them over and frees them once it is done
+    TArray<uint32> RawDataRad = MoveTemp(PackedData.RawDataRad);
+    const int64 StagingBytes = RawDataRad.GetAllocatedSize();
+    INC_MEMORY_STAT_BY(STAT_Wil21UploadStaging, StagingBytes);
     ENQUEUE_RENDER_COMMAND(InitializeBufferCommand)(  
-        [this, DataRad = MoveTemp(DataRad)](FRHICommandListImmediate&RHICmdList)  
+        [Slot = CoefficientBuffer, Packed = PackedData, RawDataRad = MoveTemp(RawDataRad), StagingBytes](FRHICommandListImmediate&RHICmdList) mutable
         {  
-            FRHIResourceCreateInfo CreateInfo(TEXT("Wil21ComputeShaderDataRad"));  
-            DataRadBuffer = RHICmdList.CreateVertexBuffer(DataRad.Num() * sizeof(uint32), BUF_Static | BUF_ShaderResource, CreateInfo);  
-            
-            void* BufferData = RHICmdList.LockBuffer(DataRadBuffer, 0, DataRad.Num() * sizeof(uint32), RLM_WriteOnly);  
-            FMemory::Memcpy(BufferData, DataRad.GetData(), DataRad.Num() * sizeof(uint32));  
-            RHICmdList.UnlockBuffer(DataRadBuffer);
-            FRDGBufferDesc BufferDesc = FRDGBufferDesc::CreateBufferDesc(sizeof(uint32), ShaderPackedData.DataRad.Num());  
-            FRDGPooledBuffer* PooledBuffer = new FRDGPooledBuffer(DataRadBuffer, BufferDesc, ShaderPackedData.DataRad.Num(), TEXT("DataRadPoolBuffer"));  
-            DataRadPooledBuffer = TRefCountPtr<FRDGPooledBuffer>(PooledBuffer);  
-            
+            LLM_SCOPE_BYTAG(Wil21Model);
+            if (RawDataRad.Num() > 0 && Packed.DataRadSize > 0)
+            {
+                Slot->DataRad = CreateWil21CoefficientBuffer(RHICmdList, Packed, RawDataRad);
+                Slot->ResidentBytes = int64(Packed.DataRadSize) * sizeof(uint32);
+                INC_MEMORY_STAT_BY(STAT_Wil21GpuCoefficients, Slot->ResidentBytes);
+            }
+            RawDataRad.Empty();
+            DEC_MEMORY_STAT_BY(STAT_Wil21UploadStaging, StagingBytes);
         }  
     );
     
 }  
 
 
+// Keeps the evaluator unless it was built for older slices or another build got there first
+static void PublishCpuEvaluator(FWil21CpuEvaluatorSlot& Slot, uint32 Generation, FRadianceData&& Radiance)
+{
+    TSharedPtr<const FWil21CpuEvaluator, ESPMode::ThreadSafe> Evaluator = MakeShared<const FWil21CpuEvaluator, ESPMode::ThreadSafe>(MoveTemp(Radiance));
+    FScopeLock Lock(&Slot.Lock);
+    if (Slot.Generation == Generation && !Slot.Evaluator.IsValid())
+    {
+        Slot.Evaluator = MoveTemp(Evaluator);
+    }
+}
+
+void ADataProcessor::ReleaseCpuCoefficients()
+{
+    // The GPU decodes its own copy from the raw configurations, loads leave the doubles undecoded until a CPU query needs them.
+    // Queries still holding the previous evaluator keep it alive until they finish.
+    SkyModelData.RadianceData.DataRad.Empty();
+    TSharedPtr<const FWil21CpuEvaluator, ESPMode::ThreadSafe> Previous;
+    uint32 Generation = 0;
+    {
+        FScopeLock Lock(&CpuEvaluatorSlot->Lock);
+        Previous = MoveTemp(CpuEvaluatorSlot->Evaluator);
+        Generation = ++CpuEvaluatorSlot->Generation;
+    }
+    if (bPrepareCpuEvaluator)
+    {
+        PrepareCpuEvaluator(Generation);
+    }
+}
+
+void ADataProcessor::PrepareCpuEvaluator(uint32 Generation)
+{
+    check(IsInGameThread());
+    if (SkyModelData.RadianceData.AltitudesRad.Num() == 0)
+    {
+        return;
+    }
+    TSharedRef<FWil21CpuEvaluatorSlot, ESPMode::ThreadSafe> Slot = CpuEvaluatorSlot;
+    if (Dataset)
+    {
+        // Decoded on the thread pool along with the streaming, the game thread only hands the result over
+        Dataset->LoadSlicesAsync(LoadedVisibility, GetResidentAltitude(), [Slot, Generation](FSkyModelData& NewData, FShaderPackedData& NewPacked)
+        {
+            if (NewPacked.DataRadSize > 0)
+            {
+                PublishCpuEvaluator(*Slot, Generation, MoveTemp(NewData.RadianceData));
+            }
+        }, true);
+        return;
+    }
+    if (LoadedFileName.IsEmpty())
+    {
+        return;
+    }
+    Async(EAsyncExecution::ThreadPool, [Slot, Generation, FileName = LoadedFileName, Visibility = LoadedVisibility, Altitude = GetResidentAltitude()]()
+    {
+        LLM_SCOPE_BYTAG(Wil21Model);
+        FSkyModelData Reloaded;
+        if (UWil21BlueprintLibrary::ReadDatFileFromContentFolder(Reloaded, FileName, Visibility, Altitude, false, true).DataRadSize > 0)
+        {
+            PublishCpuEvaluator(*Slot, Generation, MoveTemp(Reloaded.RadianceData));
+        }
+    });
+}
+
+TSharedPtr<const FWil21CpuEvaluator, ESPMode::ThreadSafe> ADataProcessor::TryGetCpuEvaluator() const
+{
+    FScopeLock Lock(&CpuEvaluatorSlot->Lock);
+    return CpuEvaluatorSlot->Evaluator;
+}
+
+TSharedPtr<const FWil21CpuEvaluator, ESPMode::ThreadSafe> ADataProcessor::GetCpuEvaluator() const
+{
+    check(IsInGameThread());
+    uint32 Generation = 0;
+    {
+        FScopeLock Lock(&CpuEvaluatorSlot->Lock);
+        if (CpuEvaluatorSlot->Evaluator.IsValid() || SkyModelData.RadianceData.AltitudesRad.Num() == 0)
+        {
+            return CpuEvaluatorSlot->Evaluator;
+        }
+        Generation = CpuEvaluatorSlot->Generation;
+    }
+
+    LLM_SCOPE_BYTAG(Wil21Model);
+    FRadianceData EvaluatorData;
+    if (ReloadResidentSlices(EvaluatorData))
+    {
+        PublishCpuEvaluator(*CpuEvaluatorSlot, Generation, MoveTemp(EvaluatorData));
+    }
+    return TryGetCpuEvaluator();
+}
+
+double ADataProcessor::GetResidentAltitude() const
+{
+    // The midpoint of two loaded altitudes brackets exactly those two
+    const FRadianceData& Resident = SkyModelData.RadianceData;
+    return Resident.AltitudesInFile.Num() > Resident.AltitudesRad.Num() ? 0.5 * (Resident.AltitudesRad[0] + Resident.AltitudesRad.Last()) : -1.0;
+}
+
+bool ADataProcessor::ReloadResidentSlices(FRadianceData& OutRadiance, TArray<uint32>* OutRawDataRad) const
+{
+    const double Altitude = GetResidentAltitude();
+    if (Dataset)
+    {
+        return Dataset->LoadSlices(LoadedVisibility, Altitude, OutRadiance, OutRawDataRad);
+    }
+    if (LoadedFileName.IsEmpty())
+    {
+        return false;
+    }
+    FSkyModelData Reloaded;
+    FShaderPackedData Packed = UWil21BlueprintLibrary::ReadDatFileFromContentFolder(Reloaded, LoadedFileName, LoadedVisibility, Altitude, false, true);
+    OutRadiance = MoveTemp(Reloaded.RadianceData);
+    if (OutRawDataRad)
+    {
+        *OutRawDataRad = MoveTemp(Packed.RawDataRad);
+    }
+    return Packed.DataRadSize > 0;
+}
+
+void ADataProcessor::CompareDf64(int32 Width, int32 Iterations)
+{
+    check(IsInGameThread());
+    FRadianceData Radiance;
+    TArray<uint32> RawDataRad;
+    if (SkyModelData.RadianceData.AltitudesRad.Num() == 0 || !ReloadResidentSlices(Radiance, &RawDataRad))
+    {
+        UE_LOG(LogTemp, Warning, TEXT("Wil21.CompareDf64: %s has no dataset loaded"), *GetName());
+        return;
+    }
+    // Full rank, so only the arithmetic differs from the CPU reference
+    FShaderPackedData Packed = UWil21BlueprintLibrary::PackRadianceData(Radiance, MoveTemp(RawDataRad));
+    RawDataRad = MoveTemp(Packed.RawDataRad);
+
+    // Pixel centres of the panorama, from the same view table as the shaders
+    const FIntPoint Size(FMath::Clamp(Width, 32, 4096), FMath::Max(FMath::Clamp(Width, 32, 4096) / 2, 16));
+    FShaderControlData Control = ShaderControlData;
+    Control.bSkyViewLUT = false;
+    TArray<FVector4f> ViewTable;
+    BuildWil21ViewTable(Size, false, ViewTable);
+    TArray<FVector> Directions;
+    Directions.Reserve(Size.X * Size.Y);
+    for (int32 Y = 0; Y < Size.Y; ++Y)
+    {
+        for (int32 X = 0; X < Size.X; ++X)
+        {
+            Directions.Add(FVector(FVector3f(GetWil21ViewDirection(ViewTable, Size, FIntPoint(X, Y)))));
+        }
+    }
+    TArray<FLinearColor> Reference;
+    Reference.SetNumZeroed(Directions.Num());
+    FWil21CpuEvaluator(MoveTemp(Radiance)).EvaluateRGB(Directions, Control, Reference);
+
+    FWil21Df64Comparison Comparison;
+    ENQUEUE_RENDER_COMMAND(Wil21CompareDf64)(
+        [&Comparison, &Packed, &RawDataRad, &Control, &Reference, Size, Iterations](FRHICommandListImmediate& RHICmdList)
+        {
+            Comparison = CompareWil21Df64(RHICmdList, Packed, RawDataRad, Control, Size, FMath::Max(Iterations, 1), Reference);
+        });
+    FlushRenderingCommands();
+
+    static const TCHAR* PathNames[] = { TEXT("fp64"), TEXT("df64") };
+    for (int32 Path = 0; Path < 2; ++Path)
+    {
+        UE_LOG(LogTemp, Log, TEXT("Wil21.CompareDf64 %s %dx%d: %.3f ms, luminance error against the CPU max %.3g mean %.3g"), PathNames[Path], Size.X, Size.Y,
+            Comparison.Milliseconds[Path], Comparison.MaxRelativeError[Path], Comparison.MeanRelativeError[Path]);
+    }
+}
+
+TArray<FLinearColor> ADataProcessor::QuerySkyRadianceRGB(const TArray<FVector>& Directions, const FShaderControlData& Control) const
+{
+    TArray<FLinearColor> Colors;
+    Colors.SetNumZeroed(Directions.Num());
+    if (TSharedPtr<const FWil21CpuEvaluator, ESPMode::ThreadSafe> Evaluator = IsInGameThread() ? GetCpuEvaluator() : TryGetCpuEvaluator())
+    {
+        Evaluator->EvaluateRGB(Directions, Control, Colors);
+    }
+    return Colors;
+}
+
+TArray<double> ADataProcessor::QuerySkyRadianceSpectra(const TArray<FVector>& Directions, const FShaderControlData& Control, TArray<double>& OutChannelWavelengths) const
+{
+    TArray<double> Spectra;
+    OutChannelWavelengths.Reset();
+    TSharedPtr<const FWil21CpuEvaluator, ESPMode::ThreadSafe> Evaluator = IsInGameThread() ? GetCpuEvaluator() : TryGetCpuEvaluator();
+    if (!Evaluator.IsValid())
+    {
+        return Spectra;
+    }
+    const FRadianceData& Radiance = Evaluator->GetRadianceData();
+    for (int32 Channel = 0; Channel < Radiance.Channels; ++Channel)
+    {
+        OutChannelWavelengths.Add(Wil21Spectrum::GetChannelWavelength(Channel, Radiance.ChannelStart, Radiance.ChannelWidth));
+    }
+    Spectra.SetNumUninitialized(Directions.Num() * Radiance.Channels);
+    Evaluator->EvaluateSpectra(Directions, Control, Spectra);
+    return Spectra;
+}
+
 void ADataProcessor::SetVariable(float SolarElevation,float SolarAzimuth, float Albedo, float Visibility)
 {
-    FShaderControlData NewData;
-    NewData.Altitude = 0;
-    NewData.Resolution = 1024;
+    // Everything SetVariable does not take, e.g. altitude, resolution and the sky-view LUT mode, is kept
+    FShaderControlData NewData = ShaderControlData;
     NewData.Albedo = Albedo;
     NewData.SolarElevation = SolarElevation;
     NewData.SolarAzimuth = SolarAzimuth;
@@ -461,36 +544,210 @@ void ADataProcessor::SetVariable(float SolarElevation,float SolarAzimuth, float
     
 }
 
-double ADataProcessor::DoubleFromHalf(uint16 Half)  
-{  
-    uint32 Hi = (uint32)(Half & 0x8000) << 16;  
-    uint16 Abs = Half & 0x7FFF;  
-    if (Abs)  
-    {  
-        Hi |= 0x3F000000 << (uint16)(Abs >= 0x7C00);  
-        while (Abs < 0x400)  
-        {  
-            Abs <<= 1;  
-            Hi -= 0x100000;  
-        }  
-        Hi += (uint32)Abs << 10;  
-    }  
-    uint64 DBits = (uint64)Hi << 32;  
-    double Out;  
-    FMemory::Memcpy(&Out, &DBits, sizeof(double));  
-    return Out;  
-}
 void ADataProcessor::OnVariableChanged()
 {
-    if (!OutputRenderTarget)  
+    EnsureOutputRenderTarget();
+    UpdateSunLight();
+    StreamAltitudeSlicesIfNeeded();
+    RequestSkyRender();
+}
+
+void ADataProcessor::Tick(float DeltaSeconds)
+{
+    Super::Tick(DeltaSeconds);
+
+    if (RenderScheduler.IsValid())
     {
-        OutputRenderTarget = NewObject<UTextureRenderTarget2D>();
-        OutputRenderTarget->InitCustomFormat(1024, 512, PF_FloatRGBA, false);
-        OutputRenderTarget->UpdateResourceImmediate();
-        // UE_LOG(LogTemp, Warning, TEXT("OutputRenderTarget is not initialized"));  
-        // return;  
+        RenderScheduler->Tick();
+    }
+    // The kept rank terms and the coefficient format are fixed at upload, a different r.Wil21.RankQuality or r.Wil21.Df64
+    // re-reads the resident slices
+    if (ShaderPackedData.SourceRank > 0 && !bAltitudeStreamInFlight)
+    {
+        const int32 WantedLayout = GetWil21KeptRank(ShaderPackedData) * 2 + (UseWil21Df64() ? 1 : 0);
+        if (WantedLayout != ShaderPackedData.Rank * 2 + (ShaderPackedData.bDf64Coefficients ? 1 : 0) && WantedLayout != LayoutReloadRequested)
+        {
+            LayoutReloadRequested = WantedLayout;
+            StreamAltitudeSlices();
+        }
+    }
+    UpdateLuminanceStats();
+    UpdateSkyReadback();
+    if (!bFollowCameraAltitude)
+    {
+        return;
+    }
+    APlayerCameraManager* CameraManager = UGameplayStatics::GetPlayerCameraManager(this, 0);
+    if (!CameraManager)
+    {
+        return;
+    }
+    // World units are centimetres, the model works in metres above the ground
+    const float CameraAltitude = FMath::Max(0.0f, float(CameraManager->GetCameraLocation().Z) / 100.0f + CameraAltitudeOffset);
+    if (FMath::Abs(CameraAltitude - ShaderControlData.Altitude) > AltitudeUpdateThreshold)
+    {
+        ShaderControlData.Altitude = CameraAltitude;
+        OnVariableChanged();
     }
-    UseRDGComputeWil21(GetWorld(), ShaderPackedData, ShaderControlData);
+}
+
+void ADataProcessor::UpdateLuminanceStats()
+{
+    if (!LuminanceReadback.IsValid())
+    {
+        return;
+    }
+    // The readback is only checked for completion, results show up a few frames after the sky was generated
+    ENQUEUE_RENDER_COMMAND(PollLuminanceCommand)(
+        [Luminance = LuminanceReadback](FRHICommandListImmediate& RHICmdList)
+        {
+            PollWil21LuminanceReadback(*Luminance);
+        });
+
+    FWil21LuminanceStats Stats = LuminanceReadback->GetLatest();
+    if (Stats.bValid)
+    {
+        SkyMeanLuminance = Stats.Mean;
+        SkyLogAverageLuminance = Stats.LogAverage;
+        SkyMaxLuminance = Stats.Max;
+        SkyLuminanceHistogram.SetNum(Stats.Histogram.Num());
+        for (int32 Bin = 0; Bin < Stats.Histogram.Num(); ++Bin)
+        {
+            SkyLuminanceHistogram[Bin] = int32(Stats.Histogram[Bin]);
+        }
+    }
+}
+
+void ADataProcessor::UpdateSkyReadback()
+{
+    if (!SkyReadback.IsValid())
+    {
+        return;
+    }
+    ENQUEUE_RENDER_COMMAND(PollSkyReadbackCommand)(
+        [Readback = SkyReadback](FRHICommandListImmediate& RHICmdList)
+        {
+            PollWil21SkyReadback(*Readback);
+        });
+
+    for (const FWil21SkyPixels& Sky : SkyReadback->TakeCompleted())
+    {
+        OnSkyReadBack.Broadcast(Sky.Control, Sky.Size.X, Sky.Size.Y, Sky.Pixels);
+    }
+}
+
+bool ADataProcessor::ShouldTickIfViewportsOnly() const
+{
+    return bComputeLuminance || bProgressiveRegeneration || bReadBackSky;
+}
+
+void ADataProcessor::StreamAltitudeSlicesIfNeeded()
+{
+    const FRadianceData& RadianceData = SkyModelData.RadianceData;
+    if (bAltitudeStreamInFlight || RadianceData.AltitudesRad.Num() == 0 || RadianceData.AltitudesInFile.Num() <= RadianceData.AltitudesRad.Num())
+    {
+        return;
+    }
+
+    TArray<double> WantedAltitudes;
+    UWil21BlueprintLibrary::SelectBracket(RadianceData.AltitudesInFile, true, ShaderControlData.Altitude, WantedAltitudes);
+    if (WantedAltitudes == RadianceData.AltitudesRad)
+    {
+        return;
+    }
+    StreamAltitudeSlices();
+}
+
+void ADataProcessor::StreamAltitudeSlices()
+{
+    // Read the bracketing slices off the game thread, the shader keeps clamping to the resident slices meanwhile
+    bAltitudeStreamInFlight = true;
+    TWeakObjectPtr<ADataProcessor> WeakThis(this);
+    if (Dataset)
+    {
+        Dataset->LoadSlicesAsync(LoadedVisibility, ShaderControlData.Altitude, [WeakThis](FSkyModelData& NewData, FShaderPackedData& NewPacked)
+        {
+            if (ADataProcessor* This = WeakThis.Get())
+            {
+                This->OnAltitudeSlicesLoaded(NewData, NewPacked);
+            }
+        });
+        return;
+    }
+    Async(EAsyncExecution::ThreadPool, [WeakThis, FileName = LoadedFileName, Visibility = LoadedVisibility, Altitude = double(ShaderControlData.Altitude)]()
+    {
+        TSharedRef<FSkyModelData, ESPMode::ThreadSafe> NewData = MakeShared<FSkyModelData, ESPMode::ThreadSafe>();
+        TSharedRef<FShaderPackedData, ESPMode::ThreadSafe> NewPacked = MakeShared<FShaderPackedData, ESPMode::ThreadSafe>(
+            UWil21BlueprintLibrary::ReadDatFileFromContentFolder(*NewData, FileName, Visibility, Altitude, false, false));
+        AsyncTask(ENamedThreads::GameThread, [WeakThis, NewData, NewPacked]()
+        {
+            if (ADataProcessor* This = WeakThis.Get())
+            {
+                This->OnAltitudeSlicesLoaded(NewData.Get(), NewPacked.Get());
+            }
+        });
+    });
+}
+
+void ADataProcessor::OnAltitudeSlicesLoaded(FSkyModelData& NewData, FShaderPackedData& NewPacked)
+{
+    bAltitudeStreamInFlight = false;
+    if (NewPacked.DataRadSize == 0)
+    {
+        UE_LOG(LogTemp, Error, TEXT("Failed to stream altitude slices from %s"), Dataset ? *Dataset->GetName() : *LoadedFileName);
+        return;
+    }
+
+    // Transmittance covers every altitude already, only the radiance slices change
+    SkyModelData.RadianceData = MoveTemp(NewData.RadianceData);
+    ShaderPackedData = MoveTemp(NewPacked);
+    ReleaseCpuCoefficients();
+    InitializePersistentBuffer(ShaderPackedData);
+    OnVariableChanged();
+}
+
+void ADataProcessor::EnsureSunTransmittanceLoaded()
+{
+    if (bTransmittanceRequested || (!Dataset && LoadedFileName.IsEmpty()))
+    {
+        return;
+    }
+    // One attempt per dataset, a dataset without a transmittance block keeps the white sun
+    bTransmittanceRequested = true;
+    LLM_SCOPE_BYTAG(Wil21Model);
+    if (Dataset)
+    {
+        if (Dataset->HasTransmittance())
+        {
+            SkyModelData.TransmittanceData = Dataset->TransmittanceData;
+            SunTransmittanceLUT.Build(SkyModelData);
+        }
+    }
+    else if (UWil21BlueprintLibrary::ReadTransmittanceFromContentFolder(LoadedFileName, SkyModelData.RadianceData.Channels, SkyModelData.TransmittanceData))
+    {
+        SunTransmittanceLUT.Build(SkyModelData);
+    }
+}
+
+void ADataProcessor::UpdateSunLight()
+{
+    if (SunLight)
+    {
+        EnsureSunTransmittanceLoaded();
+    }
+    SunTransmittanceColor = SunTransmittanceLUT.Sample(ShaderControlData.SolarElevation, ShaderControlData.Visibility, ShaderControlData.Altitude);
+    if (!SunLight)
+    {
+        return;
+    }
+    UDirectionalLightComponent* LightComponent = Cast<UDirectionalLightComponent>(SunLight->GetLightComponent());
+    if (!LightComponent)
+    {
+        return;
+    }
+    // Use the same transmittance for the lit scene and the visible disc so both agree with the sky
+    LightComponent->SetLightColor(SunTransmittanceColor, false);
+    LightComponent->SetAtmosphereSunDiskColorScale(SunTransmittanceColor);
 }
 #if WITH_EDITOR  
 void ADataProcessor::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)  
@@ -500,10 +757,20 @@ void ADataProcessor::PostEditChangeProperty(FPropertyChangedEvent& PropertyChang
         ? PropertyChangedEvent.Property->GetFName()   
         : NAME_None;  
 
+    if (PropertyName == GET_MEMBER_NAME_CHECKED(ADataProcessor, Dataset) && !bAltitudeStreamInFlight)
+    {
+        LoadDataset();
+    }
+
     if (PropertyName == GET_MEMBER_NAME_CHECKED(FShaderControlData, SolarElevation) ||  
         PropertyName == GET_MEMBER_NAME_CHECKED(FShaderControlData, SolarAzimuth) ||  
         PropertyName == GET_MEMBER_NAME_CHECKED(FShaderControlData, Albedo) ||  
-        PropertyName == GET_MEMBER_NAME_CHECKED(FShaderControlData, Visibility))  
+        PropertyName == GET_MEMBER_NAME_CHECKED(FShaderControlData, Visibility) ||  
+        PropertyName == GET_MEMBER_NAME_CHECKED(FShaderControlData, Altitude) ||
+        PropertyName == GET_MEMBER_NAME_CHECKED(FShaderControlData, Resolution) ||
+        PropertyName == GET_MEMBER_NAME_CHECKED(FShaderControlData, bSkyViewLUT) ||
+        PropertyName == GET_MEMBER_NAME_CHECKED(ADataProcessor, OutputHeight) ||
+        PropertyChangedEvent.GetMemberPropertyName() == GET_MEMBER_NAME_CHECKED(ADataProcessor, SkyViewLUTSize))  
     {
         if (!GetWorld()->GetTimerManager().IsTimerActive(SliderUpdateTimerHandle))  
         {  
@@ -0,0 +1,323 @@
+#include "Wil21ChunkedDataset.h"
+#include "Wil21DatasetIndex.h"
+#include "Wil21Memory.h"
+#include "Async/ParallelFor.h"
+#include "GenericPlatform/GenericPlatformFile.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformFilemanager.h"
+#include "Misc/Compression.h"
+#include "Misc/Paths.h"
+
+namespace
+{
+	constexpr uint32 ContainerMagic = 0x57323143; // "W21C"
+	constexpr uint32 ContainerVersion = 1;
+}
+
+FArchive& operator<<(FArchive& Ar, FWil21ChunkedDataset& Dataset)
+{
+	FString FormatName = Dataset.CompressionFormat.ToString();
+	Ar << FormatName;
+	if (Ar.IsLoading())
+	{
+		Dataset.CompressionFormat = FName(*FormatName);
+	}
+
+	FRadianceData& Header = Dataset.Header;
+	FRadianceMetadata& Metadata = Header.MetadataRad;
+	Ar << Header.VisibilitiesInFile << Header.AlbedosRad << Header.AltitudesInFile << Header.ElevationsRad;
+	Ar << Header.Channels << Header.ChannelStart << Header.ChannelWidth;
+	Ar << Metadata.Rank << Metadata.SunBreaks << Metadata.ZenithBreaks << Metadata.EmphBreaks;
+
+	FTransmittanceData& Transmittance = Dataset.TransmittanceHeader;
+	Ar << Transmittance.DDim << Transmittance.ADim << Transmittance.RankTrans << Transmittance.AltitudesTrans << Transmittance.VisibilitiesTrans;
+
+	Ar << Dataset.RadianceChunks << Dataset.TransmittanceUChunk << Dataset.TransmittanceVChunk;
+	return Ar;
+}
+
+bool FWil21ChunkedDataset::IsChunkedDataset(const FString& Path)
+{
+	return FPaths::GetExtension(Path).Equals(TEXT("w21c"), ESearchCase::IgnoreCase);
+}
+
+bool FWil21ChunkedDataset::Write(const FString& DatPath, const FString& OutPath, FName CompressionFormat)
+{
+	if (!FCompression::IsFormatValid(CompressionFormat))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Unknown compression format %s"), *CompressionFormat.ToString());
+		return false;
+	}
+
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	TUniquePtr<IFileHandle> Handle(PlatformFile.OpenRead(*DatPath));
+	FWil21DatasetIndex Index;
+	FWil21ChunkedDataset Dataset;
+	Dataset.CompressionFormat = CompressionFormat;
+	Dataset.TransmittanceHeader = FTransmittanceData();
+	if (!Handle || !FWil21DatasetIndex::LoadOrBuild(DatPath, Handle.Get(), Index) ||
+		!Handle->Seek(Index.RadianceHeaderOffset) || !UWil21BlueprintLibrary::ReadRadianceHeader(Handle.Get(), Dataset.Header))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Failed to read dataset header: %s"), *DatPath);
+		return false;
+	}
+
+	// Source byte range of every chunk: the radiance slices in file order, then the transmittance U and V arrays
+	TArray<TPair<int64, int64>> Ranges;
+	for (int32 Vis = 0; Vis < Index.VisibilityCount; ++Vis)
+	{
+		for (int32 Alb = 0; Alb < Index.AlbedoCount; ++Alb)
+		{
+			for (int32 Alt = 0; Alt < Index.AltitudeCount; ++Alt)
+			{
+				Ranges.Emplace(Index.GetAltitudeSliceOffset(Vis, Alb, Alt), Index.GetAltitudeSliceBytes());
+			}
+		}
+	}
+	const int32 RadianceChunkCount = Ranges.Num();
+	if (Index.HasTransmittance())
+	{
+		if (!Handle->Seek(Index.TransmittanceHeaderOffset) || !UWil21BlueprintLibrary::ReadTransmittanceHeader(Handle.Get(), Dataset.TransmittanceHeader))
+		{
+			UE_LOG(LogTemp, Error, TEXT("Failed to read transmittance header: %s"), *DatPath);
+			return false;
+		}
+		Ranges.Emplace(Index.TransmittanceUOffset, Index.TransmittanceVOffset - Index.TransmittanceUOffset);
+		Ranges.Emplace(Index.TransmittanceVOffset, Index.TransmittanceEndOffset - Index.TransmittanceVOffset);
+	}
+	Handle.Reset();
+
+	TArray<TArray<uint8>> Payloads;
+	Payloads.SetNum(Ranges.Num());
+	FThreadSafeCounter FailedChunks;
+	ParallelFor(Ranges.Num(), [&](int32 ChunkIdx)
+	{
+		const int64 Bytes = Ranges[ChunkIdx].Value;
+		TUniquePtr<IFileHandle> ChunkHandle(PlatformFile.OpenRead(*DatPath));
+		TArray<uint8> Source;
+		if (Bytes > MAX_int32 || !ChunkHandle || !ChunkHandle->Seek(Ranges[ChunkIdx].Key))
+		{
+			FailedChunks.Increment();
+			return;
+		}
+		Source.SetNumUninitialized(int32(Bytes));
+		if (!ChunkHandle->Read(Source.GetData(), Bytes))
+		{
+			FailedChunks.Increment();
+			return;
+		}
+
+		// A chunk that does not shrink is stored as is
+		TArray<uint8>& Payload = Payloads[ChunkIdx];
+		int32 CompressedBytes = FCompression::CompressMemoryBound(CompressionFormat, Source.Num());
+		Payload.SetNumUninitialized(CompressedBytes);
+		if (FCompression::CompressMemory(CompressionFormat, Payload.GetData(), CompressedBytes, Source.GetData(), Source.Num(), COMPRESS_BiasSize) && CompressedBytes < Source.Num())
+		{
+			Payload.SetNum(CompressedBytes);
+		}
+		else
+		{
+			Payload = MoveTemp(Source);
+		}
+	});
+	if (FailedChunks.GetValue() > 0)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Failed to read %d chunks of %s"), FailedChunks.GetValue(), *DatPath);
+		return false;
+	}
+
+	int64 Offset = 0;
+	int64 UncompressedTotal = 0;
+	for (int32 ChunkIdx = 0; ChunkIdx < Ranges.Num(); ++ChunkIdx)
+	{
+		FChunk Chunk;
+		Chunk.Offset = Offset;
+		Chunk.CompressedBytes = Payloads[ChunkIdx].Num();
+		Chunk.UncompressedBytes = Ranges[ChunkIdx].Value;
+		Offset += Chunk.CompressedBytes;
+		UncompressedTotal += Chunk.UncompressedBytes;
+		if (ChunkIdx < RadianceChunkCount)
+		{
+			Dataset.RadianceChunks.Add(Chunk);
+		}
+		else if (ChunkIdx == RadianceChunkCount)
+		{
+			Dataset.TransmittanceUChunk = Chunk;
+		}
+		else
+		{
+			Dataset.TransmittanceVChunk = Chunk;
+		}
+	}
+
+	TUniquePtr<FArchive> Writer(IFileManager::Get().CreateFileWriter(*OutPath));
+	if (!Writer)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Failed to create %s"), *OutPath);
+		return false;
+	}
+	uint32 Magic = ContainerMagic;
+	uint32 Version = ContainerVersion;
+	*Writer << Magic << Version << Dataset;
+	for (TArray<uint8>& Payload : Payloads)
+	{
+		Writer->Serialize(Payload.GetData(), Payload.Num());
+	}
+	if (!Writer->Close())
+	{
+		UE_LOG(LogTemp, Error, TEXT("Failed to write %s"), *OutPath);
+		return false;
+	}
+	UE_LOG(LogTemp, Log, TEXT("Compressed %s with %s: %lld -> %lld bytes in %d chunks"), *DatPath, *CompressionFormat.ToString(), UncompressedTotal, Offset, Ranges.Num());
+	return true;
+}
+
+bool FWil21ChunkedDataset::Open(const FString& Path, FWil21ChunkedDataset& OutDataset)
+{
+	OutDataset = FWil21ChunkedDataset();
+	OutDataset.TransmittanceHeader = FTransmittanceData();
+	TUniquePtr<FArchive> Reader(IFileManager::Get().CreateFileReader(*Path));
+	if (!Reader)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Failed to open file: %s"), *Path);
+		return false;
+	}
+	uint32 Magic = 0;
+	uint32 Version = 0;
+	*Reader << Magic << Version;
+	if (Magic != ContainerMagic || Version != ContainerVersion)
+	{
+		UE_LOG(LogTemp, Error, TEXT("%s is not a Wil21 dataset container of version %u"), *Path, ContainerVersion);
+		return false;
+	}
+	*Reader << OutDataset;
+	OutDataset.Path = Path;
+	OutDataset.ChunkDataOffset = Reader->Tell();
+
+	const FRadianceData& Header = OutDataset.Header;
+	if (Reader->IsError() || OutDataset.RadianceChunks.Num() != Header.VisibilitiesInFile.Num() * Header.AlbedosRad.Num() * Header.AltitudesInFile.Num())
+	{
+		UE_LOG(LogTemp, Error, TEXT("Corrupt chunk index in %s"), *Path);
+		return false;
+	}
+	if (!FCompression::IsFormatValid(OutDataset.CompressionFormat))
+	{
+		UE_LOG(LogTemp, Error, TEXT("%s needs the unavailable compression format %s"), *Path, *OutDataset.CompressionFormat.ToString());
+		return false;
+	}
+	UWil21BlueprintLibrary::ComputeRadianceStrides(OutDataset.Header.MetadataRad);
+	return true;
+}
+
+bool FWil21ChunkedDataset::ReadChunk(const FChunk& Chunk, void* Dest, int64 DestBytes) const
+{
+	if (Chunk.UncompressedBytes != DestBytes)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Chunk of %s holds %lld bytes, %lld expected"), *Path, Chunk.UncompressedBytes, DestBytes);
+		return false;
+	}
+	TUniquePtr<IFileHandle> Handle(FPlatformFileManager::Get().GetPlatformFile().OpenRead(*Path));
+	if (!Handle || !Handle->Seek(ChunkDataOffset + Chunk.Offset))
+	{
+		return false;
+	}
+	if (Chunk.CompressedBytes == Chunk.UncompressedBytes)
+	{
+		return Handle->Read(static_cast<uint8*>(Dest), DestBytes);
+	}
+	TArray64<uint8> Compressed;
+	Compressed.SetNumUninitialized(Chunk.CompressedBytes);
+	return Handle->Read(Compressed.GetData(), Chunk.CompressedBytes) &&
+		FCompression::UncompressMemory(CompressionFormat, Dest, DestBytes, Compressed.GetData(), Chunk.CompressedBytes);
+}
+
+bool FWil21ChunkedDataset::ReadRadiance(double SingleVisibility, double SingleAltitude, FRadianceData& Result, TArray<uint32>* OutRawDataRad, bool bDecodeCoefficients) const
+{
+	LLM_SCOPE_BYTAG(Wil21Model);
+	Result = Header;
+	const int32 SkippedVisibilities = UWil21BlueprintLibrary::SelectBracket(Header.VisibilitiesInFile, SingleVisibility > 0.0, SingleVisibility, Result.VisibilitiesRad);
+	const int32 SkippedAltitudes = UWil21BlueprintLibrary::SelectBracket(Header.AltitudesInFile, SingleAltitude >= 0.0, SingleAltitude, Result.AltitudesRad);
+
+	const int32 ConfigsPerAltitude = Header.Channels * Header.ElevationsRad.Num();
+	const int64 SliceBytes = UWil21BlueprintLibrary::GetRadianceConfigByteCount(Header.MetadataRad) * ConfigsPerAltitude;
+	const int64 SliceCoefs = int64(ConfigsPerAltitude) * Header.MetadataRad.TotalCoefsSingleConfig;
+	const int32 AlbedoCount = Result.AlbedosRad.Num();
+	const int32 AltitudeCount = Result.AltitudesRad.Num();
+	const int32 SliceCount = Result.VisibilitiesRad.Num() * AlbedoCount * AltitudeCount;
+	if (!UWil21BlueprintLibrary::IsRadianceSizeSupported(SliceCoefs * SliceCount, SliceBytes * SliceCount))
+	{
+		return false;
+	}
+	Result.MetadataRad.TotalCoefsAllConfigs = int32(SliceCoefs * SliceCount);
+	Result.DataRad.Empty();
+	if (bDecodeCoefficients)
+	{
+		Result.DataRad.SetNumUninitialized(Result.MetadataRad.TotalCoefsAllConfigs);
+	}
+	TArray<uint32> RawData;
+	RawData.SetNumZeroed(FMath::DivideAndRoundUp<int64>(SliceBytes * SliceCount, sizeof(uint32)));
+	uint8* Raw = reinterpret_cast<uint8*>(RawData.GetData());
+
+	// Slice i of DataRad (visibility, albedo, altitude order) is decompressed into slice i of the raw data and decoded from there
+	FThreadSafeCounter FailedChunks;
+	ParallelFor(SliceCount, [&](int32 Slice)
+	{
+		const int32 Alt = Slice % AltitudeCount;
+		const int32 Alb = (Slice / AltitudeCount) % AlbedoCount;
+		const int32 Vis = Slice / (AltitudeCount * AlbedoCount);
+		uint8* SliceRaw = Raw + SliceBytes * Slice;
+		if (!ReadChunk(RadianceChunks[GetChunkIndex(SkippedVisibilities + Vis, Alb, SkippedAltitudes + Alt)], SliceRaw, SliceBytes))
+		{
+			FailedChunks.Increment();
+			return;
+		}
+		if (bDecodeCoefficients)
+		{
+			UWil21BlueprintLibrary::DecodeRadianceConfigs(SliceRaw, ConfigsPerAltitude, Result.MetadataRad, Result.DataRad.GetData() + SliceCoefs * Slice);
+		}
+	});
+	if (FailedChunks.GetValue() > 0)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Failed to read %d radiance chunks of %s"), FailedChunks.GetValue(), *Path);
+		return false;
+	}
+
+	if (OutRawDataRad)
+	{
+		*OutRawDataRad = MoveTemp(RawData);
+	}
+	return true;
+}
+
+bool FWil21ChunkedDataset::ReadTransmittance(int Channels, FTransmittanceData& Result) const
+{
+	if (!HasTransmittance())
+	{
+		UE_LOG(LogTemp, Error, TEXT("Dataset has no transmittance block"));
+		return false;
+	}
+	LLM_SCOPE_BYTAG(Wil21Model);
+	Result = TransmittanceHeader;
+	Result.DataTransU.SetNumUninitialized(int64(Result.DDim) * Result.ADim * Result.RankTrans * Result.AltitudesTrans.Num());
+	Result.DataTransV.SetNumUninitialized(int64(Result.VisibilitiesTrans.Num()) * Result.RankTrans * Channels * Result.AltitudesTrans.Num());
+
+	bool bRead[2] = { false, false };
+	ParallelFor(2, [&](int32 Part)
+	{
+		TArray<float>& Data = Part == 0 ? Result.DataTransU : Result.DataTransV;
+		bRead[Part] = ReadChunk(Part == 0 ? TransmittanceUChunk : TransmittanceVChunk, Data.GetData(), Data.Num() * int64(sizeof(float)));
+	});
+	return bRead[0] && bRead[1];
+}
+
+static FAutoConsoleCommand GWil21CompressDatasetCommand(
+	TEXT("Wil21.CompressDataset"),
+	TEXT("Writes a chunked compressed copy (.w21c) of a dataset from the plugin Content folder next to it.\n")
+	TEXT("Usage: Wil21.CompressDataset [FileName=SkyModelDatasetGround.dat] [Format=Oodle]"),
+	FConsoleCommandWithArgsDelegate::CreateStatic([](const TArray<FString>& Args)
+	{
+		const FString DatPath = UWil21BlueprintLibrary::GetDatasetPath(Args.Num() > 0 ? Args[0] : TEXT("SkyModelDatasetGround.dat"));
+		const FName Format = Args.Num() > 1 ? FName(*Args[1]) : NAME_Oodle;
+		FWil21ChunkedDataset::Write(DatPath, FPaths::ChangeExtension(DatPath, TEXT("w21c")), Format);
+	}));
@@ -0,0 +1,174 @@
+#include "Wil21CpuEvaluator.h"
+#include "Wil21Geometry.h"
+#include "Wil21Memory.h"
+#include "Wil21Spectrum.h"
+#include "Math/VectorRegister.h"
+
+namespace
+{
+	constexpr int32 BatchSize = 4;
+
+	// One of the 16 visibility/albedo/altitude/elevation corners, with its weight in the multilinear blend
+	struct FCorner
+	{
+		int32 ConfigIndex = 0;
+		double Weight = 0.0;
+	};
+
+	// Per-lane segment of the sun (gamma), zenith (alpha) and emphasize (zero) curves
+	struct FAngleBatch
+	{
+		int32 GammaIndex[BatchSize];
+		int32 AlphaIndex[BatchSize];
+		int32 ZeroIndex[BatchSize];
+		VectorRegister4Double GammaFactor;
+		VectorRegister4Double AlphaFactor;
+		VectorRegister4Double ZeroFactor;
+	};
+
+	FORCEINLINE VectorRegister4Double EvalPL(const double* Data, const int32 (&Index)[BatchSize], const VectorRegister4Double& Factor)
+	{
+		const VectorRegister4Double Low = MakeVectorRegisterDouble(Data[Index[0]], Data[Index[1]], Data[Index[2]], Data[Index[3]]);
+		const VectorRegister4Double High = MakeVectorRegisterDouble(Data[Index[0] + 1], Data[Index[1] + 1], Data[Index[2] + 1], Data[Index[3] + 1]);
+		return VectorMultiplyAdd(VectorSubtract(High, Low), Factor, Low);
+	}
+
+	FORCEINLINE VectorRegister4Double Reconstruct(const double* Config, const FRadianceMetadata& Metadata, const FAngleBatch& Angles)
+	{
+		VectorRegister4Double Result = VectorZeroDouble();
+		for (int32 R = 0; R < Metadata.Rank; ++R)
+		{
+			const VectorRegister4Double Sun = EvalPL(Config + Metadata.SunOffset + R * Metadata.SunStride, Angles.GammaIndex, Angles.GammaFactor);
+			const VectorRegister4Double Zenith = EvalPL(Config + Metadata.ZenithOffset + R * Metadata.ZenithStride, Angles.AlphaIndex, Angles.AlphaFactor);
+			Result = VectorMultiplyAdd(Sun, Zenith, Result);
+		}
+		const VectorRegister4Double Emph = EvalPL(Config + Metadata.EmphOffset, Angles.ZeroIndex, Angles.ZeroFactor);
+		return VectorMax(VectorMultiply(Result, Emph), VectorZeroDouble());
+	}
+}
+
+FWil21CpuEvaluator::FWil21CpuEvaluator(FRadianceData InRadiance)
+	: Radiance(MoveTemp(InRadiance))
+{
+	ChannelToRGB = Wil21Spectrum::ComputeChannelToRGB(Radiance.Channels, Radiance.ChannelStart, Radiance.ChannelWidth);
+	INC_MEMORY_STAT_BY(STAT_Wil21CpuCoefficients, Radiance.DataRad.GetAllocatedSize());
+}
+
+FWil21CpuEvaluator::~FWil21CpuEvaluator()
+{
+	DEC_MEMORY_STAT_BY(STAT_Wil21CpuCoefficients, Radiance.DataRad.GetAllocatedSize());
+}
+
+void FWil21CpuEvaluator::EvaluateSpectra(TArrayView<const FVector> Directions, const FShaderControlData& Control, TArrayView<double> OutSpectra) const
+{
+	const int32 Channels = Radiance.Channels;
+	check(OutSpectra.Num() == Directions.Num() * Channels);
+	if (!IsValid())
+	{
+		FMemory::Memzero(OutSpectra.GetData(), OutSpectra.Num() * sizeof(double));
+		return;
+	}
+	const FRadianceMetadata& Metadata = Radiance.MetadataRad;
+
+	// Everything but the view direction is shared by the whole call, the same geometry the shaders get
+	const FWil21SkyGeometry Geometry(Control);
+	const bool bBelowHorizon = Geometry.SolarElevation < 0.0;
+
+	// Only the 2^k corners of the k active axes are evaluated, the same ones the shaders get
+	const FWil21ControlCorners ControlCorners(Radiance.VisibilitiesRad, Radiance.AlbedosRad, Radiance.AltitudesRad, Radiance.ElevationsRad, Control);
+	const FWil21Interpolation (&Interpolations)[4] = ControlCorners.Axes;
+	const uint32 ActiveMask = ControlCorners.ActiveMask;
+	const uint32 UpperMask = ControlCorners.UpperMask;
+	const int32 Counts[4] = { Radiance.VisibilitiesRad.Num(), Radiance.AlbedosRad.Num(), Radiance.AltitudesRad.Num(), Radiance.ElevationsRad.Num() };
+
+	TArray<FCorner, TInlineAllocator<16>> Corners;
+	for (uint32 Subset = ActiveMask;; Subset = (Subset - 1) & ActiveMask)
+	{
+		const uint32 Corner = Subset | UpperMask;
+		int32 Index[4];
+		double Weight = 1.0;
+		for (int32 Axis = 0; Axis < 4; ++Axis)
+		{
+			const uint32 Bit = 1u << (3 - Axis);
+			Index[Axis] = FMath::Min(Interpolations[Axis].Index + ((Corner & Bit) ? 1 : 0), Counts[Axis] - 1);
+			if (ActiveMask & Bit)
+			{
+				Weight *= (Corner & Bit) ? Interpolations[Axis].Factor : 1.0 - Interpolations[Axis].Factor;
+			}
+		}
+		// Configs are stored channel fastest, then elevation, altitude, albedo and visibility
+		const int32 ConfigIndex = Channels * (Index[3] + Counts[3] * (Index[2] + Counts[2] * (Index[1] + Counts[1] * Index[0])));
+		Corners.Add({ ConfigIndex, Weight });
+		if (Subset == 0)
+		{
+			break;
+		}
+	}
+
+	const double* Data = Radiance.DataRad.GetData();
+	for (int32 First = 0; First < Directions.Num(); First += BatchSize)
+	{
+		const int32 LaneCount = FMath::Min(BatchSize, Directions.Num() - First);
+		double GammaFactor[BatchSize];
+		double AlphaFactor[BatchSize];
+		double ZeroFactor[BatchSize];
+		FAngleBatch Angles;
+		for (int32 Lane = 0; Lane < BatchSize; ++Lane)
+		{
+			// Unused lanes repeat the last direction and are never stored
+			const FVector View = Directions[First + FMath::Min(Lane, LaneCount - 1)].GetSafeNormal(UE_SMALL_NUMBER, FVector::UpVector);
+			const FVector CorrectView = (View + FVector(0.0, 0.0, Geometry.ViewCorrection)).GetSafeNormal(UE_SMALL_NUMBER, FVector::UpVector);
+			const double Gamma = Wil21FastAcos(View | Geometry.SunDirection);
+			const double Zero = Wil21FastAcos(CorrectView.Z);
+			const double Alpha = bBelowHorizon ? Wil21FastAcos(CorrectView | Geometry.ShadowDirection) : Zero;
+
+			const FWil21Interpolation GammaParam = GetWil21Interpolation(Metadata.SunBreaks, Gamma);
+			const FWil21Interpolation AlphaParam = GetWil21Interpolation(Metadata.ZenithBreaks, Alpha);
+			const FWil21Interpolation ZeroParam = GetWil21Interpolation(Metadata.EmphBreaks, Zero);
+			Angles.GammaIndex[Lane] = GammaParam.Index;
+			Angles.AlphaIndex[Lane] = AlphaParam.Index;
+			Angles.ZeroIndex[Lane] = ZeroParam.Index;
+			GammaFactor[Lane] = GammaParam.Factor;
+			AlphaFactor[Lane] = AlphaParam.Factor;
+			ZeroFactor[Lane] = ZeroParam.Factor;
+		}
+		Angles.GammaFactor = VectorLoad(GammaFactor);
+		Angles.AlphaFactor = VectorLoad(AlphaFactor);
+		Angles.ZeroFactor = VectorLoad(ZeroFactor);
+
+		for (int32 Channel = 0; Channel < Channels; ++Channel)
+		{
+			VectorRegister4Double Result = VectorZeroDouble();
+			for (const FCorner& Corner : Corners)
+			{
+				const double* Config = Data + int64(Corner.ConfigIndex + Channel) * Metadata.TotalCoefsSingleConfig;
+				Result = VectorMultiplyAdd(Reconstruct(Config, Metadata, Angles), MakeVectorRegisterDouble(Corner.Weight, Corner.Weight, Corner.Weight, Corner.Weight), Result);
+			}
+			double Lanes[BatchSize];
+			VectorStore(Result, Lanes);
+			for (int32 Lane = 0; Lane < LaneCount; ++Lane)
+			{
+				OutSpectra[(First + Lane) * Channels + Channel] = Lanes[Lane];
+			}
+		}
+	}
+}
+
+void FWil21CpuEvaluator::EvaluateRGB(TArrayView<const FVector> Directions, const FShaderControlData& Control, TArrayView<FLinearColor> OutColors) const
+{
+	check(OutColors.Num() == Directions.Num());
+	const int32 Channels = Radiance.Channels;
+	TArray<double> Spectra;
+	Spectra.SetNumUninitialized(Directions.Num() * Channels);
+	EvaluateSpectra(Directions, Control, Spectra);
+
+	for (int32 DirIdx = 0; DirIdx < Directions.Num(); ++DirIdx)
+	{
+		FVector3d Color = FVector3d::ZeroVector;
+		for (int32 Channel = 0; Channel < Channels; ++Channel)
+		{
+			Color += ChannelToRGB[Channel] * Spectra[DirIdx * Channels + Channel];
+		}
+		OutColors[DirIdx] = FLinearColor(float(Color.X), float(Color.Y), float(Color.Z), 1.0f);
+	}
+}
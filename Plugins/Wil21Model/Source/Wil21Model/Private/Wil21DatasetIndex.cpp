@@ -0,0 +1,214 @@
+#include "Wil21DatasetIndex.h"
+#include "DatProcessor.h"
+#include "GenericPlatform/GenericPlatformFile.h"
+#include "HAL/PlatformFilemanager.h"
+#include "Hash/CityHash.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Misc/ScopeLock.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+namespace
+{
+	constexpr uint32 TocMagic = 0x57323154; // "W21T"
+	constexpr uint32 TocVersion = 1;
+	constexpr int64 FingerprintTailBytes = 64 * 1024;
+
+	FCriticalSection IndexCacheLock;
+	TMap<FString, FWil21DatasetIndex> IndexCache;
+
+	// Next to the dataset when the content folder is writable, otherwise under Saved/
+	FString GetSidecarPath(const FString& DatasetPath)
+	{
+		return DatasetPath + TEXT(".toc");
+	}
+
+	FString GetSavedSidecarPath(const FString& DatasetPath)
+	{
+		return FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Wil21Model"), FPaths::GetCleanFilename(DatasetPath) + TEXT(".toc"));
+	}
+
+	bool LoadSidecar(const FString& SidecarPath, FWil21DatasetIndex& OutIndex)
+	{
+		TArray<uint8> Bytes;
+		if (!FFileHelper::LoadFileToArray(Bytes, *SidecarPath, FILEREAD_Silent))
+		{
+			return false;
+		}
+		FMemoryReader Reader(Bytes);
+		uint32 Magic = 0;
+		uint32 Version = 0;
+		Reader << Magic << Version;
+		if (Magic != TocMagic || Version != TocVersion)
+		{
+			return false;
+		}
+		Reader << OutIndex;
+		return !Reader.IsError();
+	}
+
+	bool SaveSidecar(const FString& SidecarPath, FWil21DatasetIndex& Index)
+	{
+		TArray<uint8> Bytes;
+		FMemoryWriter Writer(Bytes);
+		uint32 Magic = TocMagic;
+		uint32 Version = TocVersion;
+		Writer << Magic << Version << Index;
+		FPlatformFileManager::Get().GetPlatformFile().CreateDirectoryTree(*FPaths::GetPath(SidecarPath));
+		return FFileHelper::SaveArrayToFile(Bytes, *SidecarPath);
+	}
+}
+
+FArchive& operator<<(FArchive& Ar, FWil21DatasetIndex& Index)
+{
+	Ar << Index.FileSize << Index.Fingerprint;
+	Ar << Index.RadianceHeaderOffset << Index.RadianceDataOffset << Index.RadianceConfigBytes;
+	Ar << Index.VisibilityCount << Index.AlbedoCount << Index.AltitudeCount << Index.ConfigsPerAltitude;
+	Ar << Index.VisibilitySliceOffsets << Index.AltitudeSliceOffsets;
+	Ar << Index.TransmittanceHeaderOffset << Index.TransmittanceUOffset << Index.TransmittanceVOffset << Index.TransmittanceEndOffset;
+	Ar << Index.PolarisationOffset;
+	return Ar;
+}
+
+uint64 FWil21DatasetIndex::ComputeFingerprint(IFileHandle* Handle, const FWil21DatasetIndex& Index)
+{
+	// Hashing the whole dataset costs as much as reading it; the block headers and the file tail change with any re-export
+	TArray<uint8> Bytes;
+	auto Append = [&](int64 Offset, int64 Count) -> bool
+	{
+		if (Offset < 0 || Count < 0 || Offset + Count > Index.FileSize)
+		{
+			return false;
+		}
+		const int32 Start = Bytes.AddUninitialized(int32(Count));
+		return Handle->Seek(Offset) && Handle->Read(Bytes.GetData() + Start, Count);
+	};
+
+	const int64 TailBytes = FMath::Min(Index.FileSize, FingerprintTailBytes);
+	if (!Append(Index.RadianceHeaderOffset, Index.RadianceDataOffset - Index.RadianceHeaderOffset) ||
+		(Index.HasTransmittance() && !Append(Index.TransmittanceHeaderOffset, Index.TransmittanceUOffset - Index.TransmittanceHeaderOffset)) ||
+		!Append(Index.FileSize - TailBytes, TailBytes))
+	{
+		return 0;
+	}
+	return CityHash64WithSeed((const char*)Bytes.GetData(), Bytes.Num(), uint64(Index.FileSize));
+}
+
+bool FWil21DatasetIndex::Build(IFileHandle* Handle, FWil21DatasetIndex& OutIndex)
+{
+	OutIndex = FWil21DatasetIndex();
+	if (!Handle || !Handle->Seek(0))
+	{
+		return false;
+	}
+	OutIndex.FileSize = Handle->Size();
+
+	FRadianceData Radiance;
+	if (!UWil21BlueprintLibrary::ReadRadianceHeader(Handle, Radiance))
+	{
+		return false;
+	}
+	OutIndex.RadianceDataOffset = Handle->Tell();
+	OutIndex.RadianceConfigBytes = UWil21BlueprintLibrary::GetRadianceConfigByteCount(Radiance.MetadataRad);
+	OutIndex.VisibilityCount = Radiance.VisibilitiesInFile.Num();
+	OutIndex.AlbedoCount = Radiance.AlbedosRad.Num();
+	OutIndex.AltitudeCount = Radiance.AltitudesInFile.Num();
+	OutIndex.ConfigsPerAltitude = Radiance.Channels * Radiance.ElevationsRad.Num();
+
+	// Configs are stored channel fastest, then elevation, altitude, albedo and visibility
+	const int64 SliceBytes = OutIndex.GetAltitudeSliceBytes();
+	OutIndex.AltitudeSliceOffsets.Reserve(OutIndex.VisibilityCount * OutIndex.AlbedoCount * OutIndex.AltitudeCount);
+	for (int32 Vis = 0; Vis < OutIndex.VisibilityCount; ++Vis)
+	{
+		OutIndex.VisibilitySliceOffsets.Add(OutIndex.RadianceDataOffset + SliceBytes * OutIndex.AltitudeSliceOffsets.Num());
+		for (int32 Slice = 0; Slice < OutIndex.AlbedoCount * OutIndex.AltitudeCount; ++Slice)
+		{
+			OutIndex.AltitudeSliceOffsets.Add(OutIndex.RadianceDataOffset + SliceBytes * OutIndex.AltitudeSliceOffsets.Num());
+		}
+	}
+	const int64 RadianceEnd = OutIndex.RadianceDataOffset + SliceBytes * OutIndex.AltitudeSliceOffsets.Num();
+	if (RadianceEnd > OutIndex.FileSize)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Radiance block needs %lld bytes but the file has %lld"), RadianceEnd, OutIndex.FileSize);
+		return false;
+	}
+
+	FTransmittanceData Transmittance;
+	if (RadianceEnd < OutIndex.FileSize && Handle->Seek(RadianceEnd) && UWil21BlueprintLibrary::ReadTransmittanceHeader(Handle, Transmittance))
+	{
+		const int64 CoefsU = int64(Transmittance.DDim) * Transmittance.ADim * Transmittance.RankTrans * Transmittance.AltitudesTrans.Num();
+		const int64 CoefsV = int64(Transmittance.VisibilitiesTrans.Num()) * Transmittance.RankTrans * Radiance.Channels * Transmittance.AltitudesTrans.Num();
+		const int64 UOffset = Handle->Tell();
+		const int64 VOffset = UOffset + CoefsU * sizeof(float);
+		const int64 EndOffset = VOffset + CoefsV * sizeof(float);
+		if (EndOffset <= OutIndex.FileSize)
+		{
+			OutIndex.TransmittanceHeaderOffset = RadianceEnd;
+			OutIndex.TransmittanceUOffset = UOffset;
+			OutIndex.TransmittanceVOffset = VOffset;
+			OutIndex.TransmittanceEndOffset = EndOffset;
+			if (EndOffset < OutIndex.FileSize)
+			{
+				OutIndex.PolarisationOffset = EndOffset;
+			}
+		}
+		else
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Transmittance block is truncated, indexing radiance only"));
+		}
+	}
+
+	OutIndex.Fingerprint = ComputeFingerprint(Handle, OutIndex);
+	return OutIndex.Fingerprint != 0;
+}
+
+bool FWil21DatasetIndex::LoadOrBuild(const FString& DatasetPath, IFileHandle* Handle, FWil21DatasetIndex& OutIndex)
+{
+	if (!Handle)
+	{
+		return false;
+	}
+	const int64 FileSize = Handle->Size();
+	bool bCached = false;
+	{
+		FScopeLock Lock(&IndexCacheLock);
+		if (const FWil21DatasetIndex* Cached = IndexCache.Find(DatasetPath))
+		{
+			OutIndex = *Cached;
+			bCached = true;
+		}
+	}
+	// Checked like the sidecar, a re-export of the same size replaces the file under a running editor
+	if (bCached && OutIndex.FileSize == FileSize && OutIndex.Fingerprint == ComputeFingerprint(Handle, OutIndex))
+	{
+		return true;
+	}
+
+	bool bValid = false;
+	for (const FString& SidecarPath : { GetSidecarPath(DatasetPath), GetSavedSidecarPath(DatasetPath) })
+	{
+		if (LoadSidecar(SidecarPath, OutIndex) && OutIndex.FileSize == FileSize && OutIndex.Fingerprint == ComputeFingerprint(Handle, OutIndex))
+		{
+			bValid = true;
+			break;
+		}
+	}
+
+	if (!bValid)
+	{
+		if (!Build(Handle, OutIndex))
+		{
+			UE_LOG(LogTemp, Error, TEXT("Failed to index dataset: %s"), *DatasetPath);
+			return false;
+		}
+		if (!SaveSidecar(GetSidecarPath(DatasetPath), OutIndex) && !SaveSidecar(GetSavedSidecarPath(DatasetPath), OutIndex))
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Failed to write dataset index for %s, it will be rebuilt next run"), *DatasetPath);
+		}
+	}
+
+	FScopeLock Lock(&IndexCacheLock);
+	IndexCache.Add(DatasetPath, OutIndex);
+	return true;
+}
@@ -0,0 +1,95 @@
+#include "Wil21Rendering.h"
+#include "DataProcessorActor.h"
+#include "EngineUtils.h"
+#include "RenderGraphUtils.h"
+#include "HAL/IConsoleManager.h"
+
+static float GetWil21Luminance(const FLinearColor& Color)
+{
+	return 0.2126f * Color.R + 0.7152f * Color.G + 0.0722f * Color.B;
+}
+
+FWil21Df64Comparison CompareWil21Df64(FRHICommandListImmediate& RHIImmCmdList, const FShaderPackedData& ShaderPackedData, const TArray<uint32>& RawDataRad,
+	const FShaderControlData& ShaderControlData, FIntPoint TextureSize, int32 Iterations, TConstArrayView<FLinearColor> Reference)
+{
+	check(IsInRenderingThread());
+	FWil21Df64Comparison Comparison;
+	if (Reference.Num() != TextureSize.X * TextureSize.Y)
+	{
+		return Comparison;
+	}
+
+	// Pixels darker than this fraction of the brightest one, e.g. the night side, are compared against it instead of themselves
+	float MaxReferenceLuminance = 0.0f;
+	for (const FLinearColor& Color : Reference)
+	{
+		MaxReferenceLuminance = FMath::Max(MaxReferenceLuminance, GetWil21Luminance(Color));
+	}
+	const float LuminanceFloor = FMath::Max(MaxReferenceLuminance * 1e-4f, UE_SMALL_NUMBER);
+
+	// One tile covers the whole panorama, so each iteration is a single dispatch
+	const int32 TileSize = Align(FMath::Max(TextureSize.X, TextureSize.Y), 32);
+	// Below SM6 there is no fp64 shader to compare with
+	for (int32 Path = GMaxRHIFeatureLevel >= ERHIFeatureLevel::SM6 ? 0 : 1; Path < 2; ++Path)
+	{
+		FShaderPackedData PathPackedData = ShaderPackedData;
+		PathPackedData.bDf64Coefficients = Path == 1;
+		TRefCountPtr<FRDGPooledBuffer> DataRad = CreateWil21CoefficientBuffer(RHIImmCmdList, PathPackedData, RawDataRad);
+		if (!DataRad.IsValid())
+		{
+			continue;
+		}
+
+		// The first dispatch is not timed, it may still compile the pipeline
+		TRefCountPtr<IPooledRenderTarget> Sky;
+		RDGComputeWil21Tiles(RHIImmCmdList, PathPackedData, ShaderControlData, TextureSize, PF_A32B32G32R32F, DataRad, Sky, TileSize, 0, 1);
+		FRenderQueryRHIRef TimerQueries[2];
+		if (GSupportsTimestampRenderQueries)
+		{
+			TimerQueries[0] = RHICreateRenderQuery(RQT_AbsoluteTime);
+			TimerQueries[1] = RHICreateRenderQuery(RQT_AbsoluteTime);
+		}
+		for (int32 Iteration = 0; Iteration < Iterations; ++Iteration)
+		{
+			RDGComputeWil21Tiles(RHIImmCmdList, PathPackedData, ShaderControlData, TextureSize, PF_A32B32G32R32F, DataRad, Sky, TileSize, 0, 1,
+				Iteration == 0 ? TimerQueries[0].GetReference() : nullptr, Iteration == Iterations - 1 ? TimerQueries[1].GetReference() : nullptr);
+		}
+
+		TArray<FLinearColor> Pixels;
+		RHIImmCmdList.ReadSurfaceData(Sky->GetRHI(), FIntRect(FIntPoint::ZeroValue, TextureSize), Pixels, FReadSurfaceDataFlags(RCM_MinMax));
+		if (TimerQueries[0].IsValid())
+		{
+			uint64 StartMicroseconds = 0;
+			uint64 EndMicroseconds = 0;
+			if (RHIGetRenderQueryResult(TimerQueries[0], StartMicroseconds, true) && RHIGetRenderQueryResult(TimerQueries[1], EndMicroseconds, true))
+			{
+				Comparison.Milliseconds[Path] = float(EndMicroseconds - StartMicroseconds) / 1000.0f / Iterations;
+			}
+		}
+
+		double ErrorSum = 0.0;
+		for (int32 Index = 0; Index < FMath::Min(Pixels.Num(), Reference.Num()); ++Index)
+		{
+			const float ReferenceLuminance = GetWil21Luminance(Reference[Index]);
+			const float Error = FMath::Abs(GetWil21Luminance(Pixels[Index]) - ReferenceLuminance) / FMath::Max(ReferenceLuminance, LuminanceFloor);
+			Comparison.MaxRelativeError[Path] = FMath::Max(Comparison.MaxRelativeError[Path], Error);
+			ErrorSum += Error;
+		}
+		Comparison.MeanRelativeError[Path] = float(ErrorSum / FMath::Max(Reference.Num(), 1));
+	}
+	return Comparison;
+}
+
+static FAutoConsoleCommandWithWorldAndArgs GWil21CompareDf64Command(
+	TEXT("Wil21.CompareDf64"),
+	TEXT("Renders the sky of every Wil21 actor with the fp64 and the double-float shaders and logs GPU time and error against the CPU.\n")
+	TEXT("Usage: Wil21.CompareDf64 [Width=256] [Iterations=8]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateStatic([](const TArray<FString>& Args, UWorld* World)
+	{
+		const int32 Width = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 256;
+		const int32 Iterations = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 8;
+		for (TActorIterator<ADataProcessor> It(World); It; ++It)
+		{
+			It->CompareDf64(Width, Iterations);
+		}
+	}));
@@ -0,0 +1,82 @@
+#include "Wil21Geometry.h"
+#include "Algo/BinarySearch.h"
+
+namespace
+{
+	constexpr double PlanetRadius = 6378000.0;
+	constexpr double SafetyAltitude = 50.0;
+}
+
+FWil21SkyGeometry::FWil21SkyGeometry(const FShaderControlData& Control)
+{
+	SolarElevation = FMath::DegreesToRadians(double(Control.SolarElevation));
+	const double Azimuth = FMath::DegreesToRadians(double(Control.SolarAzimuth));
+	SunAzimuthCosSin = FVector2D(FMath::Cos(Azimuth), FMath::Sin(Azimuth));
+
+	// The planet centre is straight below the observer, so zenith is +z
+	SunDirection = FVector(SunAzimuthCosSin.X * FMath::Cos(SolarElevation), SunAzimuthCosSin.Y * FMath::Cos(SolarElevation), FMath::Sin(SolarElevation));
+	const double ShadowAngle = SolarElevation + UE_DOUBLE_HALF_PI;
+	ShadowDirection = FVector(FMath::Cos(ShadowAngle) * SunAzimuthCosSin.X, FMath::Cos(ShadowAngle) * SunAzimuthCosSin.Y, FMath::Sin(ShadowAngle));
+
+	ViewHeight = GetWil21ViewHeight(Control.Altitude);
+	// Written as h * (2R + h) to avoid cancellation
+	ViewCorrection = FMath::Sqrt(ViewHeight * (2.0 * PlanetRadius + ViewHeight)) / (PlanetRadius + ViewHeight);
+}
+
+double GetWil21ViewHeight(double Altitude)
+{
+	return FMath::Max(Altitude, 0.0) + SafetyAltitude;
+}
+
+FWil21Interpolation GetWil21Interpolation(TConstArrayView<double> Breaks, double Value)
+{
+	FWil21Interpolation Result;
+	if (Breaks.Num() < 2)
+	{
+		return Result;
+	}
+	const double Clamped = FMath::Clamp(Value, Breaks[0], Breaks.Last());
+	const int32 Next = FMath::Clamp(Algo::UpperBound(Breaks, Clamped), 1, Breaks.Num() - 1);
+	Result.Index = Next - 1;
+	Result.Factor = FMath::Clamp((Clamped - Breaks[Next - 1]) / (Breaks[Next] - Breaks[Next - 1]), 0.0, 1.0);
+	return Result;
+}
+
+FWil21ControlCorners::FWil21ControlCorners(TConstArrayView<double> Visibilities, TConstArrayView<double> Albedos, TConstArrayView<double> Altitudes,
+	TConstArrayView<double> Elevations, const FShaderControlData& Control)
+{
+	Axes[0] = GetWil21Interpolation(Visibilities, Control.Visibility);
+	Axes[1] = GetWil21Interpolation(Albedos, Control.Albedo);
+	Axes[2] = GetWil21Interpolation(Altitudes, GetWil21ViewHeight(Control.Altitude));
+	Axes[3] = GetWil21Interpolation(Elevations, Control.SolarElevation);
+	for (int32 Axis = 0; Axis < 4; ++Axis)
+	{
+		const uint32 Bit = 1u << (3 - Axis);
+		if (Axes[Axis].Factor >= 1.0 - 1e-6)
+		{
+			UpperMask |= Bit;
+		}
+		else if (Axes[Axis].Factor >= 1e-6)
+		{
+			ActiveMask |= Bit;
+		}
+	}
+}
+
+void BuildWil21ViewTable(FIntPoint Size, bool bSkyViewLUT, TArray<FVector4f>& OutTable)
+{
+	OutTable.Reset(Size.X + Size.Y);
+	for (int32 X = 0; X < Size.X; ++X)
+	{
+		// Half a turn from the sun with texels on the edges for the LUT, pixel centres over a full turn for the panorama
+		const double Azimuth = bSkyViewLUT ? double(X) / FMath::Max(Size.X - 1, 1) * UE_DOUBLE_PI : (X + 0.5) / Size.X * UE_DOUBLE_TWO_PI;
+		OutTable.Add(FVector4f(float(FMath::Cos(Azimuth)), float(FMath::Sin(Azimuth)), 0.0f, 0.0f));
+	}
+	for (int32 Y = 0; Y < Size.Y; ++Y)
+	{
+		// Quadratic in 1 - V for the LUT, linear for the panorama, the zenith in the first row
+		const double V = bSkyViewLUT ? double(Y) / FMath::Max(Size.Y - 1, 1) : (Y + 0.5) / Size.Y;
+		const double Elevation = bSkyViewLUT ? (1.0 - V) * (1.0 - V) * UE_DOUBLE_HALF_PI : (1.0 - V) * UE_DOUBLE_HALF_PI;
+		OutTable.Add(FVector4f(float(FMath::Cos(Elevation)), float(FMath::Sin(Elevation)), float(UE_DOUBLE_HALF_PI - Elevation), 0.0f));
+	}
+}
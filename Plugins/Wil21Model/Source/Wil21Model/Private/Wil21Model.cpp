@@ -1,9 +1,16 @@
 // Copyright Epic Games, Inc. All Rights Reserved.
 
 #include "Wil21Model.h"
+#include "Wil21Memory.h"
 #include "Interfaces/IPluginManager.h"
 #include "Misc/Paths.h"
 
+LLM_DEFINE_TAG(Wil21Model);
+DEFINE_STAT(STAT_Wil21CpuCoefficients);
+DEFINE_STAT(STAT_Wil21UploadStaging);
+DEFINE_STAT(STAT_Wil21GpuCoefficients);
+DEFINE_STAT(STAT_Wil21SkyCache);
+
 #define LOCTEXT_NAMESPACE "FWil21ModelModule"
 
 void FWil21ModelModule::StartupModule()
@@ -0,0 +1,171 @@
+#include "Wil21RenderScheduler.h"
+#include "RenderingThread.h"
+#include "HAL/IConsoleManager.h"
+
+static TAutoConsoleVariable<float> CVarWil21ProgressiveBudgetMs(
+	TEXT("r.Wil21.Progressive.BudgetMs"),
+	2.0f,
+	TEXT("GPU milliseconds per frame a progressive sky bake may spend, at least one tile is rendered per frame (default 2)."),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarWil21ProgressiveTileSize(
+	TEXT("r.Wil21.Progressive.TileSize"),
+	256,
+	TEXT("Edge in pixels of the tiles a progressive sky bake is split into, rounded up to 32 (default 256)."),
+	ECVF_RenderThreadSafe);
+
+void FWil21RenderScheduler::Request(FWil21RenderRequest&& InRequest)
+{
+	check(IsInGameThread());
+	FScopeLock ScopeLock(&Lock);
+	Pending = MoveTemp(InRequest);
+	QueueRenderCommand();
+}
+
+void FWil21RenderScheduler::Tick()
+{
+	check(IsInGameThread());
+	FScopeLock ScopeLock(&Lock);
+	if (bBakeInProgress)
+	{
+		QueueRenderCommand();
+	}
+}
+
+void FWil21RenderScheduler::QueueRenderCommand()
+{
+	if (bCommandQueued)
+	{
+		return;
+	}
+	bCommandQueued = true;
+	ENQUEUE_RENDER_COMMAND(Wil21ScheduledRender)(
+		[Scheduler = AsShared()](FRHICommandListImmediate& RHICmdList)
+		{
+			Scheduler->RenderPending(RHICmdList);
+		});
+}
+
+void FWil21RenderScheduler::RenderPending(FRHICommandListImmediate& RHICmdList)
+{
+	check(IsInRenderingThread());
+	TOptional<FWil21RenderRequest> Taken;
+	{
+		FScopeLock ScopeLock(&Lock);
+		Taken = MoveTemp(Pending);
+		Pending.Reset();
+		bCommandQueued = false;
+	}
+
+	if (Taken.IsSet())
+	{
+		// Newer parameters supersede a bake in flight, its tiles are dropped with the back buffer
+		Bake.Reset();
+		RenderRequest(RHICmdList, MoveTemp(Taken.GetValue()));
+	}
+	ContinueBake(RHICmdList);
+
+	FScopeLock ScopeLock(&Lock);
+	bBakeInProgress = Bake.IsSet();
+}
+
+void FWil21RenderScheduler::RenderRequest(FRHICommandListImmediate& RHICmdList, FWil21RenderRequest&& Request)
+{
+	// The buffer is filled by an earlier render command, so it is only read here on the render thread
+	if (!Request.RenderTargetRHI.IsValid() || !Request.CoefficientBuffer.IsValid() || !Request.CoefficientBuffer->DataRad.IsValid())
+	{
+		return;
+	}
+	if (Request.TemporalHistory.IsValid())
+	{
+		Request.TemporalHistory->Interval = Request.TemporalInterval;
+		Request.TemporalHistory->ClampAngle = Request.HistoryClampAngle;
+	}
+	const FIntPoint OutputSize = Request.RenderTargetRHI->GetSizeXY();
+
+	// A sky generated before for the same controls skips the evaluation, previews and temporal frames included
+	const bool bCacheEnabled = FWil21SkyCache::IsEnabled();
+	const FWil21SkyCacheKey CacheKey = FWil21SkyCache::MakeKey(Request.ShaderControlData, OutputSize, Request.RenderTargetRHI->GetFormat());
+	if (!bCacheEnabled)
+	{
+		SkyCache.Empty();
+	}
+	else if (TRefCountPtr<IPooledRenderTarget> CachedSky = SkyCache.Find(CacheKey, Request.CoefficientBuffer->DataRad))
+	{
+		PresentWil21Sky(RHICmdList, Request.ShaderControlData, Request.CoefficientBuffer->DataRad, CachedSky, Request.RenderTargetRHI,
+			Request.LuminanceReadback.Get(), Request.TemporalHistory.Get(), Request.SkyReadback.Get());
+		return;
+	}
+
+	if (Request.bProgressive && !Request.bPreview)
+	{
+		FWil21ProgressiveBake& NewBake = Bake.Emplace();
+		NewBake.CacheKey = CacheKey;
+		NewBake.TileSize = Align(FMath::Max(CVarWil21ProgressiveTileSize.GetValueOnRenderThread(), 32), 32);
+		NewBake.TotalTiles = FMath::DivideAndRoundUp(OutputSize.X, NewBake.TileSize) * FMath::DivideAndRoundUp(OutputSize.Y, NewBake.TileSize);
+		NewBake.Request = MoveTemp(Request);
+		return;
+	}
+
+	const int32 Divisor = Request.bPreview ? FMath::Max(Request.PreviewDivisor, 1) : 1;
+	const FIntPoint TextureSize(FMath::Max(OutputSize.X / Divisor, FMath::Min(OutputSize.X, 32)), FMath::Max(OutputSize.Y / Divisor, FMath::Min(OutputSize.Y, 16)));
+	TRefCountPtr<IPooledRenderTarget> GeneratedSky = RDGComputeWil21Buffer(RHICmdList, Request.ShaderPackedData, Request.ShaderControlData, TextureSize,
+		Request.CoefficientBuffer->DataRad, Request.RenderTargetRHI, Request.LuminanceReadback.Get(), Request.TemporalHistory.Get(), Request.SkyReadback.Get());
+	// Only exact skies are kept, previews are upsampled and temporal frames partly reprojected
+	if (bCacheEnabled && !Request.bPreview && Request.TemporalInterval <= 1)
+	{
+		SkyCache.Add(CacheKey, Request.CoefficientBuffer->DataRad, MoveTemp(GeneratedSky));
+	}
+}
+
+void FWil21RenderScheduler::ContinueBake(FRHICommandListImmediate& RHICmdList)
+{
+	if (!Bake.IsSet())
+	{
+		return;
+	}
+	FWil21RenderRequest& Request = Bake->Request;
+	const FIntPoint OutputSize = Request.RenderTargetRHI->GetSizeXY();
+
+	// The GPU time of an earlier batch arrives a few frames late, until then one tile per frame is rendered
+	if (TimedTiles > 0)
+	{
+		uint64 StartMicroseconds = 0;
+		uint64 EndMicroseconds = 0;
+		if (RHIGetRenderQueryResult(TileTimerQueries[0], StartMicroseconds, false) && RHIGetRenderQueryResult(TileTimerQueries[1], EndMicroseconds, false))
+		{
+			const float Milliseconds = float(EndMicroseconds - StartMicroseconds) / 1000.0f / TimedTiles;
+			MillisecondsPerTile = MillisecondsPerTile > 0.0f ? FMath::Lerp(MillisecondsPerTile, Milliseconds, 0.25f) : Milliseconds;
+			TimedTiles = 0;
+		}
+	}
+	const float BudgetMs = CVarWil21ProgressiveBudgetMs.GetValueOnRenderThread();
+	const int32 AffordableTiles = MillisecondsPerTile > 0.0f ? FMath::FloorToInt32(BudgetMs / MillisecondsPerTile) : 1;
+	const int32 TileCount = FMath::Clamp(AffordableTiles, 1, Bake->TotalTiles - Bake->NextTile);
+
+	// The queries are reused once their previous results were read
+	const bool bTimeBatch = TimedTiles == 0 && GSupportsTimestampRenderQueries;
+	if (bTimeBatch && !TileTimerQueries[0].IsValid())
+	{
+		TileTimerQueries[0] = RHICreateRenderQuery(RQT_AbsoluteTime);
+		TileTimerQueries[1] = RHICreateRenderQuery(RQT_AbsoluteTime);
+	}
+	RDGComputeWil21Tiles(RHICmdList, Request.ShaderPackedData, Request.ShaderControlData, OutputSize, Request.RenderTargetRHI->GetFormat(),
+		Request.CoefficientBuffer->DataRad, Bake->BackBuffer, Bake->TileSize, Bake->NextTile, TileCount,
+		bTimeBatch ? TileTimerQueries[0].GetReference() : nullptr, bTimeBatch ? TileTimerQueries[1].GetReference() : nullptr);
+	TimedTiles = bTimeBatch ? TileCount : TimedTiles;
+	Bake->NextTile += TileCount;
+	if (Bake->NextTile < Bake->TotalTiles)
+	{
+		return;
+	}
+
+	// Complete, the output only ever shows finished skies
+	PresentWil21Sky(RHICmdList, Request.ShaderControlData, Request.CoefficientBuffer->DataRad, Bake->BackBuffer, Request.RenderTargetRHI,
+		Request.LuminanceReadback.Get(), Request.TemporalHistory.Get(), Request.SkyReadback.Get());
+	if (FWil21SkyCache::IsEnabled())
+	{
+		SkyCache.Add(Bake->CacheKey, Request.CoefficientBuffer->DataRad, Bake->BackBuffer);
+	}
+	Bake.Reset();
+}
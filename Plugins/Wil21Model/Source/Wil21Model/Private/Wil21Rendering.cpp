@@ -5,8 +5,204 @@
 #include "Engine/TextureRenderTarget2D.h"
 
 #include "PixelShaderUtils.h"
+#include "RenderGraphUtils.h"
+#include "HAL/IConsoleManager.h"
 
 IMPLEMENT_GLOBAL_SHADER(FWil21RDGComputeShader, "/Wil21ModelShaders/Private/Wil21.usf", "Wil21CS1", SF_Compute);
+IMPLEMENT_GLOBAL_SHADER(FWil21BatchRDGComputeShader, "/Wil21ModelShaders/Private/Wil21.usf", "Wil21BatchCS", SF_Compute);
+IMPLEMENT_GLOBAL_SHADER(FWil21DecodeCoefficientsCS, "/Wil21ModelShaders/Private/Wil21Decode.usf", "Wil21DecodeCoefficientsCS", SF_Compute);
+IMPLEMENT_GLOBAL_SHADER(FWil21TemporalResolveCS, "/Wil21ModelShaders/Private/Wil21Temporal.usf", "Wil21TemporalResolveCS", SF_Compute);
+IMPLEMENT_GLOBAL_SHADER(FWil21UpsampleCS, "/Wil21ModelShaders/Private/Wil21Upsample.usf", "Wil21UpsampleCS", SF_Compute);
+IMPLEMENT_GLOBAL_SHADER(FWil21LuminanceReduceCS, "/Wil21ModelShaders/Private/Wil21Luminance.usf", "Wil21LuminanceReduceCS", SF_Compute);
+IMPLEMENT_GLOBAL_SHADER(FWil21LuminanceFinalizeCS, "/Wil21ModelShaders/Private/Wil21Luminance.usf", "Wil21LuminanceFinalizeCS", SF_Compute);
+
+static TAutoConsoleVariable<int32> CVarWil21ThreadGroupShape(
+	TEXT("r.Wil21.ThreadGroupShape"),
+	-1,
+	TEXT("Thread group shape of the sky evaluation.\n")
+	TEXT(" -1: pick for the GPU (default)\n")
+	TEXT("  0: 8x8\n")
+	TEXT("  1: 16x16\n")
+	TEXT("  2: 32x8"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarWil21StageCoefficients(
+	TEXT("r.Wil21.StageCoefficients"),
+	1,
+	TEXT("Stage the coefficients of each interpolated configuration in groupshared memory once per thread group (default 1)."),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarWil21SpecialiseLayout(
+	TEXT("r.Wil21.SpecialiseLayout"),
+	1,
+	TEXT("Use the permutation compiled for the rank of the dataset, with unrolled reconstruction loops and the breakpoints in constants, when there is one (default 1)."),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarWil21Df64(
+	TEXT("r.Wil21.Df64"),
+	-1,
+	TEXT("Evaluate the sky in double-float arithmetic instead of fp64, for GPUs where fp64 is slow or missing. Applied on the next upload.\n")
+	TEXT("The fp64 shaders are only compiled for SM6, below it double-float is used whatever the value.\n")
+	TEXT("Wil21.CompareDf64 measures both paths against the CPU reference.\n")
+	TEXT(" -1: double-float on Intel GPUs, which emulate fp64 (default)\n")
+	TEXT("  0: fp64\n")
+	TEXT("  1: double-float"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarWil21RankQuality(
+	TEXT("r.Wil21.RankQuality"),
+	3,
+	TEXT("Rank terms of the radiance reconstruction kept on the GPU, the fewest within the relative error of the level as analysed at load.\n")
+	TEXT("The dropped terms are left out of the coefficient buffer, a change uploads the dataset again.\n")
+	TEXT(" 0: 5%\n")
+	TEXT(" 1: 2%\n")
+	TEXT(" 2: 0.5%\n")
+	TEXT(" 3: full rank (default)"),
+	ECVF_Scalability | ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<float> CVarWil21TemporalMaxElevationStep(
+	TEXT("r.Wil21.Temporal.MaxElevationStep"),
+	1.0f,
+	TEXT("Largest change of the solar elevation in degrees that a temporally amortised frame reprojects, larger steps evaluate every pixel (default 1)."),
+	ECVF_RenderThreadSafe);
+
+FIntPoint GetWil21ThreadGroupSize(EWil21ThreadGroupShape Shape)
+{
+	switch (Shape)
+	{
+	case EWil21ThreadGroupShape::Group16x16: return FIntPoint(16, 16);
+	case EWil21ThreadGroupShape::Group32x8: return FIntPoint(32, 8);
+	default: return FIntPoint(8, 8);
+	}
+}
+
+EWil21ThreadGroupShape GetWil21ThreadGroupShape()
+{
+	// ES3.1 only guarantees 128 threads per group, it has no other shape compiled
+	if (GMaxRHIFeatureLevel < ERHIFeatureLevel::SM5)
+	{
+		return EWil21ThreadGroupShape::Group8x8;
+	}
+	const int32 Override = CVarWil21ThreadGroupShape.GetValueOnAnyThread();
+	if (Override >= 0 && Override < int32(EWil21ThreadGroupShape::MAX))
+	{
+		return EWil21ThreadGroupShape(Override);
+	}
+	// Rows of 32 match NVIDIA warps, 256 threads fill AMD wave64 twice; small groups keep fp64 register pressure low elsewhere
+	if (IsRHIDeviceNVIDIA())
+	{
+		return EWil21ThreadGroupShape::Group32x8;
+	}
+	if (IsRHIDeviceAMD())
+	{
+		return EWil21ThreadGroupShape::Group16x16;
+	}
+	return EWil21ThreadGroupShape::Group8x8;
+}
+
+FWil21SkyPermutationDomain GetWil21SkyPermutation(const FShaderPackedData& ShaderPackedData)
+{
+	FWil21SkyPermutationDomain PermutationVector;
+	PermutationVector.Set<FWil21ThreadGroupShapeDim>(GetWil21ThreadGroupShape());
+	// The staging budget is above the 16 KB of groupshared memory ES3.1 guarantees
+	PermutationVector.Set<FWil21StageCoefficientsDim>(CVarWil21StageCoefficients.GetValueOnAnyThread() != 0 && ShaderPackedData.TotalCoefsSingleConfig * 2 <= WIL21_STAGED_CONFIG_UINTS
+		&& GMaxRHIFeatureLevel >= ERHIFeatureLevel::SM5);
+	PermutationVector.Set<FWil21ActiveChannelsDim>(ShaderPackedData.ChannelWeights.Num() <= 10 ? 10 : WIL21_MAX_CHANNELS);
+
+	// Ranks with a permutation, as listed by FWil21RankDim, only compiled alongside the staged 10 channel loop of the shipped datasets
+	static const int32 SpecialisedRanks[] = { 6, 8, 12 };
+	auto FitsConstants = [](const TArray<DoublePacked>& Breaks) { return Breaks.Num() >= 2 && Breaks.Num() <= WIL21_MAX_CONSTANT_BREAKS; };
+	const bool bSpecialise = CVarWil21SpecialiseLayout.GetValueOnAnyThread() != 0 && MakeArrayView(SpecialisedRanks).Contains(ShaderPackedData.Rank)
+		&& PermutationVector.Get<FWil21StageCoefficientsDim>() && PermutationVector.Get<FWil21ActiveChannelsDim>() == 10
+		&& FitsConstants(ShaderPackedData.SunBreaks) && FitsConstants(ShaderPackedData.ZenithBreaks) && FitsConstants(ShaderPackedData.EmphBreaks);
+	PermutationVector.Set<FWil21RankDim>(bSpecialise ? ShaderPackedData.Rank : 0);
+	PermutationVector.Set<FWil21Df64Dim>(ShaderPackedData.bDf64Coefficients);
+	return PermutationVector;
+}
+
+bool UseWil21Df64()
+{
+	if (GMaxRHIFeatureLevel < ERHIFeatureLevel::SM6)
+	{
+		return true;
+	}
+	const int32 Override = CVarWil21Df64.GetValueOnAnyThread();
+	if (Override >= 0)
+	{
+		return Override != 0;
+	}
+	// Intel Arc and Xe emulate fp64 in software
+	return IsRHIDeviceIntel();
+}
+
+bool ShouldCompileWil21SkyPermutation(const FGlobalShaderPermutationParameters& Parameters, const FWil21SkyPermutationDomain& PermutationVector)
+{
+	// GetWil21SkyPermutation only specialises the staged 10 channel loop
+	if (PermutationVector.Get<FWil21RankDim>() != 0 && (!PermutationVector.Get<FWil21StageCoefficientsDim>() || PermutationVector.Get<FWil21ActiveChannelsDim>() != 10))
+	{
+		return false;
+	}
+	if (IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM6))
+	{
+		return true;
+	}
+	if (!PermutationVector.Get<FWil21Df64Dim>() || !IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1))
+	{
+		return false;
+	}
+	// ES3.1 guarantees 128 threads and 16 KB of groupshared memory per group
+	return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5)
+		|| (PermutationVector.Get<FWil21ThreadGroupShapeDim>() == EWil21ThreadGroupShape::Group8x8 && !PermutationVector.Get<FWil21StageCoefficientsDim>());
+}
+
+void ModifyWil21SkyCompilationEnvironment(const FWil21SkyPermutationDomain& PermutationVector, FShaderCompilerEnvironment& OutEnvironment)
+{
+	const FIntPoint GroupSize = GetWil21ThreadGroupSize(PermutationVector.Get<FWil21ThreadGroupShapeDim>());
+	OutEnvironment.SetDefine(TEXT("THREADGROUP_SIZE_X"), GroupSize.X);
+	OutEnvironment.SetDefine(TEXT("THREADGROUP_SIZE_Y"), GroupSize.Y);
+	OutEnvironment.SetDefine(TEXT("WIL21_STAGED_CONFIG_UINTS"), WIL21_STAGED_CONFIG_UINTS);
+	OutEnvironment.SetDefine(TEXT("WIL21_MAX_CHANNELS"), WIL21_MAX_CHANNELS);
+	OutEnvironment.SetDefine(TEXT("WIL21_MAX_CONSTANT_BREAKS"), WIL21_MAX_CONSTANT_BREAKS);
+	OutEnvironment.SetDefine(TEXT("WIL21_CONSTANT_BREAK_SEARCH_STEPS"), FMath::CeilLogTwo(WIL21_MAX_CONSTANT_BREAKS));
+}
+
+int32 GetWil21KeptRank(const FShaderPackedData& ShaderPackedData)
+{
+	static const float MaxErrors[] = { 0.05f, 0.02f, 0.005f };
+	const int32 Quality = CVarWil21RankQuality.GetValueOnAnyThread();
+	const int32 SourceRank = ShaderPackedData.SourceRank;
+	if (Quality < 0 || Quality >= UE_ARRAY_COUNT(MaxErrors) || ShaderPackedData.RankTruncationErrors.Num() != SourceRank)
+	{
+		return SourceRank;
+	}
+	for (int32 KeptRank = 1; KeptRank < SourceRank; ++KeptRank)
+	{
+		if (ShaderPackedData.RankTruncationErrors[KeptRank - 1] <= MaxErrors[Quality])
+		{
+			return KeptRank;
+		}
+	}
+	return SourceRank;
+}
+
+static void SetWil21LuminanceDefines(FShaderCompilerEnvironment& OutEnvironment)
+{
+	OutEnvironment.SetDefine(TEXT("WIL21_LUMINANCE_GROUP_SIZE"), WIL21_LUMINANCE_GROUP_SIZE);
+	OutEnvironment.SetDefine(TEXT("WIL21_HISTOGRAM_BINS"), WIL21_HISTOGRAM_BINS);
+	OutEnvironment.SetDefine(TEXT("WIL21_LUMINANCE_STATS"), WIL21_LUMINANCE_STATS);
+}
+
+void FWil21LuminanceReduceCS::ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+{
+	FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+	SetWil21LuminanceDefines(OutEnvironment);
+}
+
+void FWil21LuminanceFinalizeCS::ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+{
+	FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+	SetWil21LuminanceDefines(OutEnvironment);
+}
 void UWil21RenderingBlueprintLibrary::UseRDGComputeWil21(const UObject* WorldContextObject, const FShaderPackedData& ShaderPackedData, const FShaderControlData& ShaderControlData, UTextureRenderTarget2D* OutputRenderTarget)
 {
 
@@ -46,149 +242,442 @@ FRDGBufferRef CreateRawBuffer(FRDGBuilder& GraphBuilder, const TCHAR* Name, cons
 }
 
 
-void RDGComputeWil21Buffer(FRHICommandListImmediate& RHIImmCmdList, const FShaderPackedData& ShaderPackedData, const FShaderControlData& ShaderControlData, int32 OutputSize, int32 TextureSize, TRefCountPtr<FRDGPooledBuffer> DataRadPooledBuffer, FTexture2DRHIRef RenderTargetRHI)
+void AddWil21LuminancePasses(FRDGBuilder& GraphBuilder, FRDGTextureRef SkyTexture, FWil21LuminanceReadback& LuminanceReadback)
+{
+	// The reduction groups are larger than ES3.1 guarantees, the statistics stay at their last value there
+	if (GMaxRHIFeatureLevel < ERHIFeatureLevel::SM5)
+	{
+		return;
+	}
+	const FIntPoint InputSize = SkyTexture->Desc.Extent;
+	const FIntPoint GroupCount = FIntPoint::DivideAndRoundUp(InputSize, WIL21_LUMINANCE_GROUP_SIZE);
+	const uint32 PartialCount = GroupCount.X * GroupCount.Y;
+	FGlobalShaderMap* GlobalShaderMap = GetGlobalShaderMap(GMaxRHIFeatureLevel);
+
+	FRDGBufferRef PartialResults = GraphBuilder.CreateBuffer(FRDGBufferDesc::CreateStructuredDesc(sizeof(FVector4f), PartialCount), TEXT("Wil21LuminancePartials"));
+	FRDGBufferRef Stats = GraphBuilder.CreateBuffer(FRDGBufferDesc::CreateBufferDesc(sizeof(uint32), WIL21_LUMINANCE_STATS + WIL21_HISTOGRAM_BINS), TEXT("Wil21LuminanceStats"));
+	FRDGBufferUAVRef StatsUAV = GraphBuilder.CreateUAV(Stats, PF_R32_UINT);
+	AddClearUAVPass(GraphBuilder, StatsUAV, 0u);
+
+	// Each group reduces its tile in groupshared memory, then one group folds the per-tile results
+	{
+		FWil21LuminanceReduceCS::FParameters* Parameters = GraphBuilder.AllocParameters<FWil21LuminanceReduceCS::FParameters>();
+		Parameters->InTexture = SkyTexture;
+		Parameters->InputSize = FUintVector2(InputSize.X, InputSize.Y);
+		Parameters->GroupCountX = GroupCount.X;
+		Parameters->HistogramMinLog2 = LuminanceReadback.HistogramMinLog2;
+		Parameters->HistogramLog2Range = FMath::Max(LuminanceReadback.HistogramMaxLog2 - LuminanceReadback.HistogramMinLog2, 1.0f);
+		Parameters->PartialResults = GraphBuilder.CreateUAV(PartialResults);
+		Parameters->OutStats = StatsUAV;
+		TShaderMapRef<FWil21LuminanceReduceCS> ComputeShader(GlobalShaderMap);
+		FComputeShaderUtils::AddPass(GraphBuilder, RDG_EVENT_NAME("Wil21LuminanceReduce"), ComputeShader, Parameters, FIntVector(GroupCount.X, GroupCount.Y, 1));
+	}
+	{
+		FWil21LuminanceFinalizeCS::FParameters* Parameters = GraphBuilder.AllocParameters<FWil21LuminanceFinalizeCS::FParameters>();
+		Parameters->PartialCount = PartialCount;
+		Parameters->InPartialResults = GraphBuilder.CreateSRV(PartialResults);
+		Parameters->OutStats = StatsUAV;
+		TShaderMapRef<FWil21LuminanceFinalizeCS> ComputeShader(GlobalShaderMap);
+		FComputeShaderUtils::AddPass(GraphBuilder, RDG_EVENT_NAME("Wil21LuminanceFinalize"), ComputeShader, Parameters, FIntVector(1, 1, 1));
+	}
+
+	// A newer request replaces one that has not been consumed yet, only the latest sky matters
+	if (!LuminanceReadback.Readback.IsValid())
+	{
+		LuminanceReadback.Readback = MakeUnique<FRHIGPUBufferReadback>(TEXT("Wil21LuminanceReadback"));
+	}
+	AddEnqueueCopyPass(GraphBuilder, LuminanceReadback.Readback.Get(), Stats, 0);
+	LuminanceReadback.bPending = true;
+}
+
+void PollWil21LuminanceReadback(FWil21LuminanceReadback& LuminanceReadback)
 {
 	check(IsInRenderingThread());
-	// RDG Begin  
+	if (!LuminanceReadback.bPending || !LuminanceReadback.Readback->IsReady())
+	{
+		return;
+	}
+
+	const uint32 NumBytes = (WIL21_LUMINANCE_STATS + WIL21_HISTOGRAM_BINS) * sizeof(uint32);
+	const uint32* Data = static_cast<const uint32*>(LuminanceReadback.Readback->Lock(NumBytes));
+	FWil21LuminanceStats Stats;
+	Stats.Mean = FMath::AsFloat(Data[0]);
+	Stats.LogAverage = FMath::AsFloat(Data[1]);
+	Stats.Max = FMath::AsFloat(Data[2]);
+	Stats.Histogram.Append(Data + WIL21_LUMINANCE_STATS, WIL21_HISTOGRAM_BINS);
+	Stats.bValid = true;
+	LuminanceReadback.Readback->Unlock();
+	LuminanceReadback.bPending = false;
+
+	FScopeLock ScopeLock(&LuminanceReadback.Lock);
+	LuminanceReadback.Latest = MoveTemp(Stats);
+}
+
+void AddWil21SkyReadbackPass(FRDGBuilder& GraphBuilder, FRDGTextureRef SkyTexture, const FShaderControlData& ShaderControlData, FWil21SkyReadback& SkyReadback)
+{
+	const EPixelFormat Format = SkyTexture->Desc.Format;
+	if (Format != PF_FloatRGBA && Format != PF_A32B32G32R32F)
+	{
+		return;
+	}
+	if (SkyReadback.Slots.Num() == 0)
+	{
+		SkyReadback.Slots.SetNum(SkyReadback.RingSize);
+	}
+	// Waiting for a slot would stall the render thread on the GPU
+	if (SkyReadback.PendingCount == SkyReadback.Slots.Num())
+	{
+		++SkyReadback.DroppedSkies;
+		return;
+	}
+
+	FWil21SkyReadback::FSlot& Slot = SkyReadback.Slots[(SkyReadback.FirstPending + SkyReadback.PendingCount) % SkyReadback.Slots.Num()];
+	if (!Slot.Readback.IsValid())
+	{
+		Slot.Readback = MakeUnique<FRHIGPUTextureReadback>(TEXT("Wil21SkyReadback"));
+	}
+	Slot.Control = ShaderControlData;
+	Slot.Size = SkyTexture->Desc.Extent;
+	Slot.Format = Format;
+	AddEnqueueCopyPass(GraphBuilder, Slot.Readback.Get(), SkyTexture);
+	++SkyReadback.PendingCount;
+}
+
+void PollWil21SkyReadback(FWil21SkyReadback& SkyReadback)
+{
+	check(IsInRenderingThread());
+	// Copies complete in the order they were enqueued, so the oldest one gates the rest
+	while (SkyReadback.PendingCount > 0 && SkyReadback.Slots[SkyReadback.FirstPending].Readback->IsReady())
+	{
+		FWil21SkyReadback::FSlot& Slot = SkyReadback.Slots[SkyReadback.FirstPending];
+		FWil21SkyPixels Sky;
+		Sky.Control = Slot.Control;
+		Sky.Size = Slot.Size;
+		Sky.Pixels.SetNumUninitialized(Slot.Size.X * Slot.Size.Y);
+
+		int32 RowPitchInPixels = 0;
+		const uint8* Data = static_cast<const uint8*>(Slot.Readback->Lock(RowPitchInPixels));
+		for (int32 Y = 0; Data && Y < Slot.Size.Y; ++Y)
+		{
+			FLinearColor* OutRow = Sky.Pixels.GetData() + Y * Slot.Size.X;
+			if (Slot.Format == PF_A32B32G32R32F)
+			{
+				FMemory::Memcpy(OutRow, reinterpret_cast<const FLinearColor*>(Data) + int64(Y) * RowPitchInPixels, Slot.Size.X * sizeof(FLinearColor));
+			}
+			else
+			{
+				const FFloat16Color* InRow = reinterpret_cast<const FFloat16Color*>(Data) + int64(Y) * RowPitchInPixels;
+				for (int32 X = 0; X < Slot.Size.X; ++X)
+				{
+					OutRow[X] = FLinearColor(InRow[X]);
+				}
+			}
+		}
+		Slot.Readback->Unlock();
+		SkyReadback.FirstPending = (SkyReadback.FirstPending + 1) % SkyReadback.Slots.Num();
+		--SkyReadback.PendingCount;
+
+		if (Data)
+		{
+			FScopeLock ScopeLock(&SkyReadback.Lock);
+			SkyReadback.Completed.Add(MoveTemp(Sky));
+		}
+	}
+}
+
+TRefCountPtr<FRDGPooledBuffer> CreateWil21CoefficientBuffer(FRHICommandListImmediate& RHIImmCmdList, const FShaderPackedData& ShaderPackedData, const TArray<uint32>& RawDataRad)
+{
+	check(IsInRenderingThread());
+	const int64 DataRadBytes = int64(ShaderPackedData.DataRadSize) * sizeof(uint32);
+	if (DataRadBytes <= 0 || DataRadBytes > Wil21MaxDataRadBytes)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Wil21: not uploading %lld bytes of coefficients, the shaders address at most %lld"), DataRadBytes, Wil21MaxDataRadBytes);
+		return nullptr;
+	}
 	FRDGBuilder GraphBuilder(RHIImmCmdList);
 
-	TArray<FSpectrum> SpectrumData;
-	SpectrumData.SetNum(OutputSize);
-	for (FSpectrum& Spectrum : SpectrumData)  
-	{  
-		for (double& Value : Spectrum.Values)  
-		{  
-			Value = 0.0f;  
-		}  
-	} 
-	
-	FRDGBufferRef SpectrumBuffer = CreateStructuredBuffer(
-		GraphBuilder,
-		TEXT("SpectrumBuffer"),
-		sizeof(FSpectrum),  
-		SpectrumData.Num(),  
-		SpectrumData.GetData(),  
-		sizeof(FSpectrum) * OutputSize
-	);
+	// RawDataRad outlives Execute below, so the upload reads it in place
+	FRDGBufferRef RawBuffer = GraphBuilder.CreateBuffer(FRDGBufferDesc::CreateByteAddressDesc(RawDataRad.Num() * sizeof(uint32)), TEXT("Wil21RawDataRad"));
+	GraphBuilder.QueueBufferUpload(RawBuffer, RawDataRad.GetData(), RawDataRad.Num() * sizeof(uint32), ERDGInitialDataFlags::NoCopy);
+	FRDGBufferRef DataRadBuffer = GraphBuilder.CreateBuffer(FRDGBufferDesc::CreateByteAddressDesc(uint32(DataRadBytes)), TEXT("DataRadPoolBuffer"));
+
+	const uint32 CoefCount = ShaderPackedData.DataRadSize / 2;
+	const uint32 GroupCount = FMath::Clamp<uint32>(FMath::DivideAndRoundUp<uint32>(CoefCount, 64), 1, GRHIMaxDispatchThreadGroupsPerDimension.X);
+	FWil21DecodeCoefficientsCS::FParameters* Parameters = GraphBuilder.AllocParameters<FWil21DecodeCoefficientsCS::FParameters>();
+	Parameters->CoefCount = CoefCount;
+	Parameters->DispatchThreads = GroupCount * 64;
+	Parameters->ConfigBytes = ShaderPackedData.RawConfigBytes;
+	Parameters->CoefsPerConfig = ShaderPackedData.TotalCoefsSingleConfig;
+	Parameters->Rank = ShaderPackedData.Rank;
+	Parameters->SourceRank = ShaderPackedData.SourceRank;
+	Parameters->SunBreaksSize = ShaderPackedData.SunBreaksSize;
+	Parameters->ZenithBreaksSize = ShaderPackedData.ZenithBreaksSize;
+	Parameters->ChannelCount = ShaderPackedData.Channels;
+	Parameters->ElevationCount = ShaderPackedData.ElevationsRadSize;
+	Parameters->RawDataRad = GraphBuilder.CreateSRV(RawBuffer);
+	Parameters->OutDataRad = GraphBuilder.CreateUAV(DataRadBuffer);
+	FWil21DecodeCoefficientsCS::FPermutationDomain PermutationVector;
+	PermutationVector.Set<FWil21Df64Dim>(ShaderPackedData.bDf64Coefficients);
+	TShaderMapRef<FWil21DecodeCoefficientsCS> ComputeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel), PermutationVector);
+	FComputeShaderUtils::AddPass(GraphBuilder, RDG_EVENT_NAME("Wil21DecodeCoefficients %u", CoefCount), ComputeShader, Parameters, FIntVector(GroupCount, 1, 1));
+
+	TRefCountPtr<FRDGPooledBuffer> PooledBuffer;
+	GraphBuilder.QueueBufferExtraction(DataRadBuffer, &PooledBuffer);
+	GraphBuilder.Execute();
+	return PooledBuffer;
+}
+
+static FRDGBufferSRVRef CreateDoublePackedSRV(FRDGBuilder& GraphBuilder, const TCHAR* Name, const TArray<DoublePacked>& Data)
+{
+	FRDGBufferRef Buffer = CreateStructuredBuffer(GraphBuilder, Name, sizeof(DoublePacked), Data.Num(), Data.GetData(), sizeof(DoublePacked) * Data.Num());
+	return GraphBuilder.CreateSRV(Buffer, PF_Unknown);
+}
+
+void SetupWil21ModelParameters(FRDGBuilder& GraphBuilder, const FShaderPackedData& ShaderPackedData, const FWil21SkyPermutationDomain& PermutationVector, TRefCountPtr<FRDGPooledBuffer> DataRadPooledBuffer, FWil21ModelParameters& OutParameters)
+{
+	// Set RadianceMetadata parameters  
+	OutParameters.Rank = ShaderPackedData.Rank;  
+	OutParameters.SunOffset = ShaderPackedData.SunOffset;  
+	OutParameters.SunStride = ShaderPackedData.SunStride;  
+	OutParameters.ZenithOffset = ShaderPackedData.ZenithOffset;  
+	OutParameters.ZenithStride = ShaderPackedData.ZenithStride;  
+	OutParameters.EmphOffset = ShaderPackedData.EmphOffset;  
+	OutParameters.TotalCoefsSingleConfig = ShaderPackedData.TotalCoefsSingleConfig;  
+	OutParameters.TotalCoefsAllConfigs = ShaderPackedData.TotalCoefsAllConfigs;
+
+	OutParameters.ZenithBreaksSize = ShaderPackedData.ZenithBreaks.Num();
+	OutParameters.SunBreaksSize = ShaderPackedData.SunBreaks.Num();
+	OutParameters.EmphBreaksSize = ShaderPackedData.EmphBreaks.Num();
+	OutParameters.VisibilitiesRadSize = ShaderPackedData.VisibilitiesRad.Num();
+	OutParameters.AlbedosRadSize = ShaderPackedData.AlbedosRad.Num();
+	OutParameters.AltitudesRadSize = ShaderPackedData.AltitudesRad.Num();
+	OutParameters.ElevationsRadSize = ShaderPackedData.ElevationsRad.Num();
+	OutParameters.DataRadSize = ShaderPackedData.DataRadSize;
+
+	OutParameters.ChannelCount = ShaderPackedData.Channels;
+	OutParameters.ActiveChannelCount = FMath::Min(ShaderPackedData.ChannelWeights.Num(), WIL21_MAX_CHANNELS);
+	for (int32 Index = 0; Index < OutParameters.ActiveChannelCount; ++Index)
+	{
+		OutParameters.ChannelWeights[Index] = ShaderPackedData.ChannelWeights[Index];
+	}
+
+	// Only read by the specialised layouts, which are not picked when a list does not fit
+	const TArray<DoublePacked>* AngleBreaks[] = { &ShaderPackedData.SunBreaks, &ShaderPackedData.ZenithBreaks, &ShaderPackedData.EmphBreaks };
+	for (int32 Axis = 0; Axis < UE_ARRAY_COUNT(AngleBreaks) && PermutationVector.Get<FWil21RankDim>() != 0; ++Axis)
+	{
+		for (int32 Index = 0; Index < FMath::Min(AngleBreaks[Axis]->Num(), WIL21_MAX_CONSTANT_BREAKS); ++Index)
+		{
+			const DoublePacked& Break = (*AngleBreaks[Axis])[Index];
+			FUintVector4& Pair = OutParameters.ConstantBreaks[(Axis * WIL21_MAX_CONSTANT_BREAKS + Index) / 2];
+			Pair[(Index & 1) * 2] = Break.Low;
+			Pair[(Index & 1) * 2 + 1] = Break.High;
+		}
+	}
+
+	// Elements are DoublePacked, as declared by the StructuredBuffers in Wil21.usf
+	OutParameters.SunBreaks = CreateDoublePackedSRV(GraphBuilder, TEXT("SunBreaksBuffer"), ShaderPackedData.SunBreaks);
+	OutParameters.ZenithBreaks = CreateDoublePackedSRV(GraphBuilder, TEXT("ZenithBreaksBuffer"), ShaderPackedData.ZenithBreaks);
+	OutParameters.EmphBreaks = CreateDoublePackedSRV(GraphBuilder, TEXT("EmphBreaksBuffer"), ShaderPackedData.EmphBreaks);
+
+	FRDGBufferRef DataRadRDGBuffer = GraphBuilder.RegisterExternalBuffer(DataRadPooledBuffer, TEXT("DataRadBuffer"), ERDGBufferFlags::MultiFrame);
+	OutParameters.DataRad = GraphBuilder.CreateSRV(DataRadRDGBuffer);
+}
+
+void SetupWil21SkyGeometryParameters(const FShaderControlData& ShaderControlData, FWil21SkyGeometryParameters& OutParameters)
+{
+	const FWil21GpuSkyGeometry Geometry{ FWil21SkyGeometry(ShaderControlData) };
+	OutParameters.SunDirection = Geometry.SunDirection;
+	OutParameters.ViewCorrection = Geometry.ViewCorrection;
+	OutParameters.ShadowDirection = Geometry.ShadowDirection;
+	OutParameters.SolarElevation = Geometry.SolarElevation;
+	OutParameters.SunAzimuthCosSin = Geometry.SunAzimuthCosSin;
+	OutParameters.ViewHeight = Geometry.ViewHeight;
+}
+
+static TArray<double> UnpackDoubles(const TArray<DoublePacked>& Packed)
+{
+	TArray<double> Result;
+	Result.Reserve(Packed.Num());
+	for (const DoublePacked& Value : Packed)
+	{
+		const uint64 Bits = (uint64(Value.High) << 32) | Value.Low;
+		double& Unpacked = Result.AddDefaulted_GetRef();
+		FMemory::Memcpy(&Unpacked, &Bits, sizeof(double));
+	}
+	return Result;
+}
+
+static void PackDouble(double Value, uint32& OutLow, uint32& OutHigh)
+{
+	uint64 Bits;
+	FMemory::Memcpy(&Bits, &Value, sizeof(double));
+	OutLow = uint32(Bits);
+	OutHigh = uint32(Bits >> 32);
+}
+
+FWil21GpuSkyControls::FWil21GpuSkyControls(const FWil21ControlCorners& Corners)
+	: Index(Corners.Axes[0].Index, Corners.Axes[1].Index, Corners.Axes[2].Index, Corners.Axes[3].Index)
+	, ActiveMask(Corners.ActiveMask)
+	, UpperMask(Corners.UpperMask)
+{
+	PackDouble(Corners.Axes[0].Factor, FactorBits0.X, FactorBits0.Y);
+	PackDouble(Corners.Axes[1].Factor, FactorBits0.Z, FactorBits0.W);
+	PackDouble(Corners.Axes[2].Factor, FactorBits1.X, FactorBits1.Y);
+	PackDouble(Corners.Axes[3].Factor, FactorBits1.Z, FactorBits1.W);
+}
+
+FWil21ControlCorners GetWil21ControlCorners(const FShaderPackedData& ShaderPackedData, const FShaderControlData& ShaderControlData)
+{
+	return FWil21ControlCorners(UnpackDoubles(ShaderPackedData.VisibilitiesRad), UnpackDoubles(ShaderPackedData.AlbedosRad),
+		UnpackDoubles(ShaderPackedData.AltitudesRad), UnpackDoubles(ShaderPackedData.ElevationsRad), ShaderControlData);
+}
+
+void SetupWil21SkyControlParameters(const FShaderPackedData& ShaderPackedData, const FShaderControlData& ShaderControlData, FWil21SkyControlParameters& OutParameters)
+{
+	const FWil21GpuSkyControls Controls(GetWil21ControlCorners(ShaderPackedData, ShaderControlData));
+	OutParameters.ControlIndex = Controls.Index;
+	OutParameters.ControlFactorBits0 = Controls.FactorBits0;
+	OutParameters.ControlFactorBits1 = Controls.FactorBits1;
+	OutParameters.ControlActiveMask = Controls.ActiveMask;
+	OutParameters.ControlUpperMask = Controls.UpperMask;
+}
+
+// View tables of the output layouts in use, render thread only. They are a few KB each and outlive any one dispatch.
+class FWil21ViewTables : public FRenderResource
+{
+public:
+	FRDGBufferSRVRef Get(FRDGBuilder& GraphBuilder, FIntPoint OutputSize, bool bSkyViewLUT)
+	{
+		check(IsInRenderingThread());
+		for (const FTable& Table : Tables)
+		{
+			if (Table.OutputSize == OutputSize && Table.bSkyViewLUT == bSkyViewLUT)
+			{
+				return GraphBuilder.CreateSRV(GraphBuilder.RegisterExternalBuffer(Table.Buffer, TEXT("Wil21ViewTable")));
+			}
+		}
+
+		// The panorama, its preview size and a LUT are the usual set, the least recently built table makes room for a new one
+		if (Tables.Num() >= MaxTables)
+		{
+			Tables.RemoveAt(0);
+		}
+		TArray<FVector4f> Entries;
+		BuildWil21ViewTable(OutputSize, bSkyViewLUT, Entries);
+		FRDGBufferRef Buffer = CreateStructuredBuffer(GraphBuilder, TEXT("Wil21ViewTable"), sizeof(FVector4f), Entries.Num(), Entries.GetData(), sizeof(FVector4f) * Entries.Num());
+		Tables.Add({ OutputSize, bSkyViewLUT, GraphBuilder.ConvertToExternalBuffer(Buffer) });
+		return GraphBuilder.CreateSRV(Buffer);
+	}
+
+	virtual void ReleaseRHI() override
+	{
+		Tables.Empty();
+	}
+
+private:
+	static constexpr int32 MaxTables = 8;
+
+	struct FTable
+	{
+		FIntPoint OutputSize;
+		bool bSkyViewLUT;
+		TRefCountPtr<FRDGPooledBuffer> Buffer;
+	};
+	TArray<FTable> Tables;
+};
+
+static TGlobalResource<FWil21ViewTables> GWil21ViewTables;
+
+FRDGBufferSRVRef GetWil21ViewTable(FRDGBuilder& GraphBuilder, FIntPoint OutputSize, bool bSkyViewLUT)
+{
+	return GWil21ViewTables.Get(GraphBuilder, OutputSize, bSkyViewLUT);
+}
+
+void RDGComputeWil21BatchBuffer(FRHICommandListImmediate& RHIImmCmdList, const FShaderPackedData& ShaderPackedData, TConstArrayView<FShaderControlData> Controls, TRefCountPtr<FRDGPooledBuffer> DataRadPooledBuffer, FTextureRHIRef TextureArrayRHI)
+{
+	check(IsInRenderingThread());
+	const FIntVector TextureSize = TextureArrayRHI->GetSizeXYZ();
+	const int32 SliceCount = FMath::Min(Controls.Num(), TextureSize.Z);
+	if (SliceCount == 0)
+	{
+		return;
+	}
+
+	FRDGBuilder GraphBuilder(RHIImmCmdList);
+
+	TArray<FWil21BatchControl> BatchControls;
+	BatchControls.Reserve(SliceCount);
+	for (int32 Slice = 0; Slice < SliceCount; ++Slice)
+	{
+		const FShaderControlData& Control = Controls[Slice];
+		BatchControls.Add({ FWil21GpuSkyGeometry(FWil21SkyGeometry(Control)), FWil21GpuSkyControls(GetWil21ControlCorners(ShaderPackedData, Control)) });
+	}
+
+	FWil21BatchRDGComputeShader::FParameters* Parameters = GraphBuilder.AllocParameters<FWil21BatchRDGComputeShader::FParameters>();
+	Parameters->OutputSize = FIntPoint(TextureSize.X, TextureSize.Y);
+	Parameters->SliceCount = SliceCount;
+	// The slices share one array and so one layout
+	Parameters->SkyViewLUT = Controls[0].bSkyViewLUT ? 1 : 0;
+	Parameters->ViewTable = GetWil21ViewTable(GraphBuilder, Parameters->OutputSize, Controls[0].bSkyViewLUT);
+	FRDGBufferRef BatchControlsBuffer = CreateStructuredBuffer(GraphBuilder, TEXT("Wil21BatchControls"), sizeof(FWil21BatchControl), BatchControls.Num(), BatchControls.GetData(), sizeof(FWil21BatchControl) * BatchControls.Num());
+	Parameters->BatchControls = GraphBuilder.CreateSRV(BatchControlsBuffer, PF_Unknown);
+	const FWil21SkyPermutationDomain PermutationVector = GetWil21SkyPermutation(ShaderPackedData);
+	SetupWil21ModelParameters(GraphBuilder, ShaderPackedData, PermutationVector, DataRadPooledBuffer, Parameters->Model);
+
+	const FRDGTextureDesc TextureArrayDesc = FRDGTextureDesc::Create2DArray(FIntPoint(TextureSize.X, TextureSize.Y), TextureArrayRHI->GetFormat(), FClearValueBinding::Black, TexCreate_ShaderResource | TexCreate_UAV, SliceCount);
+	FRDGTextureRef RDGTextureArray = GraphBuilder.CreateTexture(TextureArrayDesc, TEXT("Wil21BatchTextureArray"));
+	Parameters->OutTextureArray = GraphBuilder.CreateUAV(FRDGTextureUAVDesc(RDGTextureArray));
+
+	FGlobalShaderMap* GlobalShaderMap = GetGlobalShaderMap(GMaxRHIFeatureLevel);
+	TShaderMapRef<FWil21BatchRDGComputeShader> ComputeShader(GlobalShaderMap, PermutationVector);
+	const FIntPoint GroupSize = GetWil21ThreadGroupSize(PermutationVector.Get<FWil21ThreadGroupShapeDim>());
+	const FIntVector ThreadGroupCount(FMath::DivideAndRoundUp(TextureSize.X, GroupSize.X), FMath::DivideAndRoundUp(TextureSize.Y, GroupSize.Y), SliceCount);
+	FComputeShaderUtils::AddPass(GraphBuilder, RDG_EVENT_NAME("Wil21RDGComputeBatch %d", SliceCount), ComputeShader, Parameters, ThreadGroupCount);
+
+	FRHICopyTextureInfo CopyInfo;
+	CopyInfo.NumSlices = SliceCount;
+	AddCopyTexturePass(GraphBuilder, RDGTextureArray, GraphBuilder.RegisterExternalTexture(CreateRenderTarget(TextureArrayRHI, TEXT("Wil21BatchOutput"))), CopyInfo);
+	GraphBuilder.Execute();
+}
+
+TRefCountPtr<IPooledRenderTarget> RDGComputeWil21Buffer(FRHICommandListImmediate& RHIImmCmdList, const FShaderPackedData& ShaderPackedData, const FShaderControlData& ShaderControlData, FIntPoint TextureSize, TRefCountPtr<FRDGPooledBuffer> DataRadPooledBuffer, FTexture2DRHIRef RenderTargetRHI, FWil21LuminanceReadback* LuminanceReadback, FWil21TemporalHistory* TemporalHistory, FWil21SkyReadback* SkyReadback)
+{
+	check(IsInRenderingThread());
+	// RDG Begin  
+	FRDGBuilder GraphBuilder(RHIImmCmdList);
 
 	TRefCountPtr<IPooledRenderTarget> PooledRenderTarget;
-	// Calculate for spectrum buffer and rgb
+	// Calculate for spectrum and rgb
 	{
 
 		// Setup Parameters  
 		FWil21RDGComputeShader::FParameters* Parameters = GraphBuilder.AllocParameters<FWil21RDGComputeShader::FParameters>();  
 		
-		// Set RadianceMetadata parameters  
-		Parameters->Rank = ShaderPackedData.Rank;  
-		Parameters->SunOffset = ShaderPackedData.SunOffset;  
-		Parameters->SunStride = ShaderPackedData.SunStride;  
-		Parameters->ZenithOffset = ShaderPackedData.ZenithOffset;  
-		Parameters->ZenithStride = ShaderPackedData.ZenithStride;  
-		Parameters->EmphOffset = ShaderPackedData.EmphOffset;  
-		Parameters->TotalCoefsSingleConfig = ShaderPackedData.TotalCoefsSingleConfig;  
-		Parameters->TotalCoefsAllConfigs = ShaderPackedData.TotalCoefsAllConfigs;
-
-		Parameters->ZenithBreaksSize = ShaderPackedData.ZenithBreaks.Num();
-		Parameters->SunBreaksSize = ShaderPackedData.SunBreaks.Num();
-		Parameters->EmphBreaksSize = ShaderPackedData.EmphBreaks.Num();
-		Parameters->VisibilitiesRadSize = ShaderPackedData.VisibilitiesRad.Num();
-		Parameters->AlbedosRadSize = ShaderPackedData.AlbedosRad.Num();
-		Parameters->AltitudesRadSize = ShaderPackedData.AltitudesRad.Num();
-		Parameters->ElevationsRadSize = ShaderPackedData.ElevationsRad.Num();
-		Parameters->DataRadSize = ShaderPackedData.DataRadSize;
-		
-		Parameters->Resolution = ShaderControlData.Resolution;
-		Parameters->SolarElevation = ShaderControlData.SolarElevation;
-		Parameters->SolarAzimuth = ShaderControlData.SolarAzimuth;
-		Parameters->Albedo = ShaderControlData.Albedo;
-		Parameters->Visibility = ShaderControlData.Visibility;
-		Parameters->Altitude = ShaderControlData.Altitude;
-
-		// vector<>
-		// Create structured buffers  
-		FRDGBufferRef SunBreaksBuffer = CreateStructuredBuffer(
-			GraphBuilder,
-			TEXT("SunBreaksBuffer"),
-			sizeof(FShaderPackedData),  
-			ShaderPackedData.SunBreaks.Num(),  
-			ShaderPackedData.SunBreaks.GetData(),  
-			sizeof(FShaderPackedData) * ShaderPackedData.SunBreaks.Num()
-		);
-		FRDGBufferRef ZenithBreaksBuffer = CreateStructuredBuffer(
-			GraphBuilder,
-			TEXT("ZenithBreaksBuffer"),
-			sizeof(FShaderPackedData),  
-			ShaderPackedData.ZenithBreaks.Num(),  
-			ShaderPackedData.ZenithBreaks.GetData(),  
-			sizeof(FShaderPackedData) * ShaderPackedData.ZenithBreaks.Num()
-		);
-		FRDGBufferRef EmphBreaksBuffer = CreateStructuredBuffer(
-			GraphBuilder,
-			TEXT("EmphBreaksBuffer"),
-			sizeof(FShaderPackedData),  
-			ShaderPackedData.EmphBreaks.Num(),  
-			ShaderPackedData.EmphBreaks.GetData(),  
-			sizeof(FShaderPackedData) * ShaderPackedData.EmphBreaks.Num()
-		);
-		FRDGBufferRef VisibilitiesRadBuffer = CreateStructuredBuffer(
-			GraphBuilder,
-			TEXT("VisibilitiesRadBuffer"),
-			sizeof(FShaderPackedData),  
-			ShaderPackedData.VisibilitiesRad.Num(),  
-			ShaderPackedData.VisibilitiesRad.GetData(),  
-			sizeof(FShaderPackedData) * ShaderPackedData.VisibilitiesRad.Num()
-		);
-		FRDGBufferRef AlbedosRadBuffer = CreateStructuredBuffer(
-			GraphBuilder,
-			TEXT("AlbedosRadBuffer"),
-			sizeof(FShaderPackedData),  
-			ShaderPackedData.AlbedosRad.Num(),  
-			ShaderPackedData.AlbedosRad.GetData(),  
-			sizeof(FShaderPackedData) * ShaderPackedData.AlbedosRad.Num()
-		);
-		FRDGBufferRef AltitudesRadBuffer = CreateStructuredBuffer(
-			GraphBuilder,
-			TEXT("AltitudesRadBuffer"),
-			sizeof(FShaderPackedData),  
-			ShaderPackedData.AltitudesRad.Num(),  
-			ShaderPackedData.AltitudesRad.GetData(),  
-			sizeof(FShaderPackedData) * ShaderPackedData.AltitudesRad.Num()
-		);
-		FRDGBufferRef ElevationsRadBuffer = CreateStructuredBuffer(
-			GraphBuilder,
-			TEXT("ElevationsRadBuffer"),
-			sizeof(FShaderPackedData),  
-			ShaderPackedData.ElevationsRad.Num(),  
-			ShaderPackedData.ElevationsRad.GetData(),  
-			sizeof(FShaderPackedData) * ShaderPackedData.ElevationsRad.Num()
-		);
-		
-		// FRDGBufferRef DataRadBuffer = CreateRawBuffer(GraphBuilder, TEXT("DataRad"), ShaderPackedData.DataRad);  
-
-		// Set parameters  
-		Parameters->SunBreaks = GraphBuilder.CreateSRV(SunBreaksBuffer, PF_Unknown);  
-		Parameters->ZenithBreaks = GraphBuilder.CreateSRV(ZenithBreaksBuffer, PF_Unknown);  
-		Parameters->EmphBreaks = GraphBuilder.CreateSRV(EmphBreaksBuffer, PF_Unknown);  
-		Parameters->VisibilitiesRad = GraphBuilder.CreateSRV(VisibilitiesRadBuffer, PF_Unknown);  
-		Parameters->AlbedosRad = GraphBuilder.CreateSRV(AlbedosRadBuffer, PF_Unknown);  
-		Parameters->AltitudesRad = GraphBuilder.CreateSRV(AltitudesRadBuffer, PF_Unknown);  
-		Parameters->ElevationsRad = GraphBuilder.CreateSRV(ElevationsRadBuffer, PF_Unknown);
-		
-		// Parameters->DataRad = GraphBuilder.CreateSRV(DataRadBuffer, PF_R32_UINT);
-		//ExternalDataRadBuffer.Buffer = PersistentDataRadBuffer;  
-		// ExternalDataRadBuffer.SRV = DataRadSRV;
+		Parameters->OutputSize = TextureSize;
+		SetupWil21SkyControlParameters(ShaderPackedData, ShaderControlData, Parameters->Controls);
+		SetupWil21SkyGeometryParameters(ShaderControlData, Parameters->Geometry);
+		Parameters->SkyViewLUT = ShaderControlData.bSkyViewLUT ? 1 : 0;
+		Parameters->ViewTable = GetWil21ViewTable(GraphBuilder, TextureSize, ShaderControlData.bSkyViewLUT);
+		const FWil21SkyPermutationDomain PermutationVector = GetWil21SkyPermutation(ShaderPackedData);
+		SetupWil21ModelParameters(GraphBuilder, ShaderPackedData, PermutationVector, DataRadPooledBuffer, Parameters->Model);
+
+		// History is only reusable for the same atmosphere and coefficients, at full resolution and for a small elevation step.
+		// The reprojection shifts panorama columns, a sky-view LUT follows the sun by construction.
+		const bool bTemporal = TemporalHistory && TemporalHistory->Interval > 1 && TemporalHistory->Texture.IsValid()
+			&& TemporalHistory->DataRad == DataRadPooledBuffer
+			&& TemporalHistory->Texture->GetDesc().Extent == TextureSize && TextureSize == RenderTargetRHI->GetSizeXY()
+			&& TemporalHistory->Control.HasSameAtmosphere(ShaderControlData) && !ShaderControlData.bSkyViewLUT
+			&& FMath::Abs(TemporalHistory->Control.SolarElevation - ShaderControlData.SolarElevation) <= CVarWil21TemporalMaxElevationStep.GetValueOnRenderThread();
+		const uint32 TemporalInterval = bTemporal ? TemporalHistory->Interval : 1;
+		const uint32 TemporalPhase = bTemporal ? TemporalHistory->FrameIndex % TemporalInterval : 0;
+		Parameters->TemporalInterval = TemporalInterval;
+		Parameters->TemporalPhase = TemporalPhase;
+		Parameters->TileOffset = FUintVector2(0, 0);
 
-		FRDGBufferRef DataRadRDGBuffer = GraphBuilder.RegisterExternalBuffer(DataRadPooledBuffer, TEXT("DataRadBuffer"), ERDGBufferFlags::MultiFrame);
-		Parameters->DataRad = GraphBuilder.CreateSRV(DataRadRDGBuffer, PF_R32_UINT);
-		
 		// FRDGBufferRef SpectralResponseData = CreateRawBuffer(GraphBuilder, TEXT("SpectralResponse"), ShaderPackedData.SpectralResponse); 
 		// Parameters->SpectralResponse = GraphBuilder.CreateSRV(SpectralResponseData, PF_R32_UINT);
 
-
-	// Set output buffer  
-	Parameters->OutputBuffer = GraphBuilder.CreateUAV(SpectrumBuffer, PF_Unknown);
-
-	const FRDGTextureDesc& RenderTargetDesc = FRDGTextureDesc::Create2D(RenderTargetRHI->GetSizeXY(),RenderTargetRHI->GetFormat(), FClearValueBinding::Black, TexCreate_RenderTargetable | TexCreate_ShaderResource | TexCreate_UAV);
+	const FRDGTextureDesc& RenderTargetDesc = FRDGTextureDesc::Create2D(TextureSize,RenderTargetRHI->GetFormat(), FClearValueBinding::Black, TexCreate_RenderTargetable | TexCreate_ShaderResource | TexCreate_UAV);
 	FRDGTextureRef RDGRenderTarget = GraphBuilder.CreateTexture(RenderTargetDesc, TEXT("RDGRenderTarget"));
 
 	FRDGTextureUAVDesc UAVDesc(RDGRenderTarget);
@@ -197,26 +686,165 @@ void RDGComputeWil21Buffer(FRHICommandListImmediate& RHIImmCmdList, const FShade
 
 	
 	// Get ComputeShader From GlobalShaderMap
-	const ERHIFeatureLevel::Type FeatureLevel = ERHIFeatureLevel::SM6;
-	FGlobalShaderMap* GlobalShaderMap = GetGlobalShaderMap(FeatureLevel);
-	TShaderMapRef<FWil21RDGComputeShader> ComputeShader(GlobalShaderMap);
-
-	// Compute Thread Group Count
-	FIntVector ThreadGroupCount(
-		TextureSize / 32,
-		TextureSize / 2 / 32,
-		1);
+	FGlobalShaderMap* GlobalShaderMap = GetGlobalShaderMap(GMaxRHIFeatureLevel);
+	TShaderMapRef<FWil21RDGComputeShader> ComputeShader(GlobalShaderMap, PermutationVector);
+
+	// Compute Thread Group Count, partial groups are bounds checked in the shader. A temporal frame covers 1 / TemporalInterval of each row.
+	const FIntPoint EvaluatedSize(FMath::DivideAndRoundUp<int32>(TextureSize.X, TemporalInterval), TextureSize.Y);
+	FIntVector ThreadGroupCount = FComputeShaderUtils::GetGroupCount(EvaluatedSize, GetWil21ThreadGroupSize(PermutationVector.Get<FWil21ThreadGroupShapeDim>()));
 	
 	GraphBuilder.AddPass(
-		RDG_EVENT_NAME("Wil21RDGCompute"),
+		RDG_EVENT_NAME("Wil21RDGCompute %dx%d", EvaluatedSize.X, EvaluatedSize.Y),
 		Parameters,
 		ERDGPassFlags::Compute,
 		[Parameters, ComputeShader, ThreadGroupCount](FRHICommandList& RHICmdList) {
 			FComputeShaderUtils::Dispatch(RHICmdList, ComputeShader, *Parameters, ThreadGroupCount);
 		});
-		GraphBuilder.QueueTextureExtraction(RDGRenderTarget, &PooledRenderTarget);
+		if (bTemporal)
+		{
+			FRDGTextureRef ResolvedTexture = GraphBuilder.CreateTexture(RenderTargetDesc, TEXT("Wil21TemporalResolved"));
+			FWil21TemporalResolveCS::FParameters* ResolveParameters = GraphBuilder.AllocParameters<FWil21TemporalResolveCS::FParameters>();
+			ResolveParameters->InTexture = RDGRenderTarget;
+			ResolveParameters->HistoryTexture = GraphBuilder.RegisterExternalTexture(TemporalHistory->Texture, TEXT("Wil21TemporalHistory"));
+			ResolveParameters->HistorySampler = TStaticSamplerState<SF_Bilinear, AM_Wrap, AM_Clamp, AM_Clamp>::GetRHI();
+			ResolveParameters->OutputSize = FUintVector2(TextureSize.X, TextureSize.Y);
+			ResolveParameters->TemporalInterval = TemporalInterval;
+			ResolveParameters->TemporalPhase = TemporalPhase;
+			ResolveParameters->HistoryShiftU = (ShaderControlData.SolarAzimuth - TemporalHistory->Control.SolarAzimuth) / 360.0f;
+			ResolveParameters->SunDirection = Parameters->Geometry.SunDirection;
+			ResolveParameters->HistoryClampCos = FMath::Cos(FMath::DegreesToRadians(TemporalHistory->ClampAngle));
+			ResolveParameters->ViewTable = Parameters->ViewTable;
+			ResolveParameters->OutTexture = GraphBuilder.CreateUAV(ResolvedTexture);
+			TShaderMapRef<FWil21TemporalResolveCS> ResolveShader(GlobalShaderMap);
+			FComputeShaderUtils::AddPass(GraphBuilder, RDG_EVENT_NAME("Wil21TemporalResolve 1/%d", TemporalInterval), ResolveShader, ResolveParameters, FComputeShaderUtils::GetGroupCount(TextureSize, 8));
+			RDGRenderTarget = ResolvedTexture;
+		}
+		if (LuminanceReadback)
+		{
+			AddWil21LuminancePasses(GraphBuilder, RDGRenderTarget, *LuminanceReadback);
+		}
+
+		FRDGTextureRef OutputTexture = RDGRenderTarget;
+		const FIntPoint OutputExtent = RenderTargetRHI->GetSizeXY();
+		if (SkyReadback && RDGRenderTarget->Desc.Extent == OutputExtent)
+		{
+			AddWil21SkyReadbackPass(GraphBuilder, RDGRenderTarget, ShaderControlData, *SkyReadback);
+		}
+		if (RDGRenderTarget->Desc.Extent != OutputExtent)
+		{
+			OutputTexture = GraphBuilder.CreateTexture(FRDGTextureDesc::Create2D(OutputExtent, RenderTargetRHI->GetFormat(), FClearValueBinding::Black, TexCreate_ShaderResource | TexCreate_UAV), TEXT("Wil21UpsampledTarget"));
+			FWil21UpsampleCS::FParameters* UpsampleParameters = GraphBuilder.AllocParameters<FWil21UpsampleCS::FParameters>();
+			UpsampleParameters->InTexture = RDGRenderTarget;
+			// Azimuth wraps around the panorama, elevation does not
+			UpsampleParameters->InSampler = TStaticSamplerState<SF_Bilinear, AM_Wrap, AM_Clamp, AM_Clamp>::GetRHI();
+			UpsampleParameters->OutputSize = FUintVector2(OutputExtent.X, OutputExtent.Y);
+			UpsampleParameters->OutTexture = GraphBuilder.CreateUAV(OutputTexture);
+			TShaderMapRef<FWil21UpsampleCS> UpsampleShader(GlobalShaderMap);
+			FComputeShaderUtils::AddPass(GraphBuilder, RDG_EVENT_NAME("Wil21Upsample"), UpsampleShader, UpsampleParameters, FComputeShaderUtils::GetGroupCount(OutputExtent, 8));
+		}
+		GraphBuilder.QueueTextureExtraction(OutputTexture, &PooledRenderTarget);
+
+		if (TemporalHistory)
+		{
+			// Previews are upsampled and would be reprojected as if they were exact, the next full frame starts over
+			const bool bPreview = RDGRenderTarget->Desc.Extent != OutputExtent;
+			TemporalHistory->FrameIndex = bTemporal ? TemporalHistory->FrameIndex + 1 : 0;
+			TemporalHistory->Control = ShaderControlData;
+			TemporalHistory->DataRad = bPreview ? nullptr : DataRadPooledBuffer;
+		}
 	}
 	
 	GraphBuilder.Execute();
+	if (TemporalHistory)
+	{
+		TemporalHistory->Texture = TemporalHistory->DataRad.IsValid() ? PooledRenderTarget : nullptr;
+	}
 	RHIImmCmdList.CopyTexture(PooledRenderTarget->GetRHI()->GetTexture2D(), RenderTargetRHI->GetTexture2D(), FRHICopyTextureInfo());
+	return PooledRenderTarget;
+}
+
+void RDGComputeWil21Tiles(FRHICommandListImmediate& RHIImmCmdList, const FShaderPackedData& ShaderPackedData, const FShaderControlData& ShaderControlData, FIntPoint TextureSize, EPixelFormat Format, TRefCountPtr<FRDGPooledBuffer> DataRadPooledBuffer, TRefCountPtr<IPooledRenderTarget>& BackBuffer, int32 TileSize, int32 FirstTile, int32 TileCount, FRHIRenderQuery* StartQuery, FRHIRenderQuery* EndQuery)
+{
+	check(IsInRenderingThread());
+	FRDGBuilder GraphBuilder(RHIImmCmdList);
+	FRDGTextureRef BackBufferTexture = BackBuffer.IsValid()
+		? GraphBuilder.RegisterExternalTexture(BackBuffer, TEXT("Wil21ProgressiveBackBuffer"))
+		: GraphBuilder.CreateTexture(FRDGTextureDesc::Create2D(TextureSize, Format, FClearValueBinding::Black, TexCreate_ShaderResource | TexCreate_UAV), TEXT("Wil21ProgressiveBackBuffer"));
+	FRDGTextureUAVRef BackBufferUAV = GraphBuilder.CreateUAV(BackBufferTexture);
+
+	FGlobalShaderMap* GlobalShaderMap = GetGlobalShaderMap(GMaxRHIFeatureLevel);
+	const FWil21SkyPermutationDomain PermutationVector = GetWil21SkyPermutation(ShaderPackedData);
+	TShaderMapRef<FWil21RDGComputeShader> ComputeShader(GlobalShaderMap, PermutationVector);
+	const FIntPoint GroupSize = GetWil21ThreadGroupSize(PermutationVector.Get<FWil21ThreadGroupShapeDim>());
+	const int32 TilesX = FMath::DivideAndRoundUp(TextureSize.X, TileSize);
+	// The coefficient and break buffers, the controls, the geometry and the view table are shared by every tile
+	FWil21ModelParameters ModelParameters;
+	SetupWil21ModelParameters(GraphBuilder, ShaderPackedData, PermutationVector, DataRadPooledBuffer, ModelParameters);
+	FWil21SkyControlParameters ControlParameters;
+	SetupWil21SkyControlParameters(ShaderPackedData, ShaderControlData, ControlParameters);
+	FWil21SkyGeometryParameters GeometryParameters;
+	SetupWil21SkyGeometryParameters(ShaderControlData, GeometryParameters);
+	FRDGBufferSRVRef ViewTable = GetWil21ViewTable(GraphBuilder, TextureSize, ShaderControlData.bSkyViewLUT);
+
+	if (StartQuery)
+	{
+		AddPass(GraphBuilder, RDG_EVENT_NAME("Wil21TileTimerStart"), [StartQuery](FRHICommandListImmediate& RHICmdList) { RHICmdList.EndRenderQuery(StartQuery); });
+	}
+	for (int32 Tile = FirstTile; Tile < FirstTile + TileCount; ++Tile)
+	{
+		const FIntPoint TileOffset((Tile % TilesX) * TileSize, (Tile / TilesX) * TileSize);
+		const FIntPoint TileExtent(FMath::Min(TileSize, TextureSize.X - TileOffset.X), FMath::Min(TileSize, TextureSize.Y - TileOffset.Y));
+
+		FWil21RDGComputeShader::FParameters* Parameters = GraphBuilder.AllocParameters<FWil21RDGComputeShader::FParameters>();
+		Parameters->OutputSize = TextureSize;
+		Parameters->Controls = ControlParameters;
+		Parameters->Geometry = GeometryParameters;
+		Parameters->SkyViewLUT = ShaderControlData.bSkyViewLUT ? 1 : 0;
+		Parameters->ViewTable = ViewTable;
+		Parameters->Model = ModelParameters;
+		Parameters->OutTexture = BackBufferUAV;
+		Parameters->TemporalInterval = 1;
+		Parameters->TemporalPhase = 0;
+		Parameters->TileOffset = FUintVector2(TileOffset.X, TileOffset.Y);
+		// Tiles are whole thread groups, the shader only clips the last row and column of tiles against OutputSize
+		FComputeShaderUtils::AddPass(GraphBuilder, RDG_EVENT_NAME("Wil21RDGComputeTile %d", Tile), ERDGPassFlags::Compute | ERDGPassFlags::NeverCull, ComputeShader, Parameters, FComputeShaderUtils::GetGroupCount(TileExtent, GroupSize));
+	}
+	if (EndQuery)
+	{
+		AddPass(GraphBuilder, RDG_EVENT_NAME("Wil21TileTimerEnd"), [EndQuery](FRHICommandListImmediate& RHICmdList) { RHICmdList.EndRenderQuery(EndQuery); });
+	}
+
+	if (!BackBuffer.IsValid())
+	{
+		GraphBuilder.QueueTextureExtraction(BackBufferTexture, &BackBuffer);
+	}
+	GraphBuilder.Execute();
+}
+
+void PresentWil21Sky(FRHICommandListImmediate& RHIImmCmdList, const FShaderControlData& ShaderControlData, TRefCountPtr<FRDGPooledBuffer> DataRadPooledBuffer, TRefCountPtr<IPooledRenderTarget> CachedSky, FTexture2DRHIRef RenderTargetRHI, FWil21LuminanceReadback* LuminanceReadback, FWil21TemporalHistory* TemporalHistory, FWil21SkyReadback* SkyReadback)
+{
+	check(IsInRenderingThread());
+	if (LuminanceReadback || SkyReadback)
+	{
+		FRDGBuilder GraphBuilder(RHIImmCmdList);
+		FRDGTextureRef SkyTexture = GraphBuilder.RegisterExternalTexture(CachedSky, TEXT("Wil21CachedSky"));
+		if (LuminanceReadback)
+		{
+			AddWil21LuminancePasses(GraphBuilder, SkyTexture, *LuminanceReadback);
+		}
+		if (SkyReadback)
+		{
+			AddWil21SkyReadbackPass(GraphBuilder, SkyTexture, ShaderControlData, *SkyReadback);
+		}
+		GraphBuilder.Execute();
+	}
+	// A full evaluation, the next temporal frame can start from it
+	if (TemporalHistory)
+	{
+		TemporalHistory->FrameIndex = 0;
+		TemporalHistory->Control = ShaderControlData;
+		TemporalHistory->DataRad = DataRadPooledBuffer;
+		TemporalHistory->Texture = CachedSky;
+	}
+	RHIImmCmdList.CopyTexture(CachedSky->GetRHI()->GetTexture2D(), RenderTargetRHI->GetTexture2D(), FRHICopyTextureInfo());
 }
\ No newline at end of file
@@ -0,0 +1,136 @@
+#include "Wil21SkyCache.h"
+#include "HAL/IConsoleManager.h"
+#include "RenderGraphResources.h"
+
+static TAutoConsoleVariable<int32> CVarWil21SkyCacheBudgetMB(
+	TEXT("r.Wil21.SkyCache.BudgetMB"),
+	64,
+	TEXT("VRAM in MB each sky output may keep for previously generated skies, 0 disables the cache (default 64)."),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<float> CVarWil21SkyCacheAngleStep(
+	TEXT("r.Wil21.SkyCache.AngleStep"),
+	0.05f,
+	TEXT("Solar elevation and azimuth in degrees closer than this share a cached sky (default 0.05)."),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<float> CVarWil21SkyCacheAltitudeStep(
+	TEXT("r.Wil21.SkyCache.AltitudeStep"),
+	1.0f,
+	TEXT("Altitudes in metres closer than this share a cached sky (default 1)."),
+	ECVF_RenderThreadSafe);
+
+// Albedo and visibility are designer presets rather than animated, a fixed fine step is enough
+static constexpr float Wil21SkyCacheAlbedoStep = 1.0f / 1024.0f;
+static constexpr float Wil21SkyCacheVisibilityStep = 0.01f;
+
+static int32 QuantiseWil21Control(float Value, float Step)
+{
+	return FMath::RoundToInt32(Value / FMath::Max(Step, UE_KINDA_SMALL_NUMBER));
+}
+
+FWil21SkyCache::~FWil21SkyCache()
+{
+	Empty();
+}
+
+FWil21SkyCacheKey FWil21SkyCache::MakeKey(const FShaderControlData& Control, FIntPoint Extent, EPixelFormat Format)
+{
+	const float AngleStep = CVarWil21SkyCacheAngleStep.GetValueOnRenderThread();
+	FWil21SkyCacheKey Key;
+	Key.SolarElevation = QuantiseWil21Control(Control.SolarElevation, AngleStep);
+	// 0 and 360 degrees are the same sky, and a sky-view LUT is measured from the sun so it is the same for every azimuth
+	Key.SolarAzimuth = Control.bSkyViewLUT ? 0 : QuantiseWil21Control(FMath::Fmod(Control.SolarAzimuth, 360.0f), AngleStep) % QuantiseWil21Control(360.0f, AngleStep);
+	Key.Albedo = QuantiseWil21Control(Control.Albedo, Wil21SkyCacheAlbedoStep);
+	Key.Visibility = QuantiseWil21Control(Control.Visibility, Wil21SkyCacheVisibilityStep);
+	Key.Altitude = QuantiseWil21Control(Control.Altitude, CVarWil21SkyCacheAltitudeStep.GetValueOnRenderThread());
+	Key.bSkyViewLUT = Control.bSkyViewLUT;
+	Key.Extent = Extent;
+	Key.Format = Format;
+	return Key;
+}
+
+bool FWil21SkyCache::IsEnabled()
+{
+	return CVarWil21SkyCacheBudgetMB.GetValueOnRenderThread() > 0;
+}
+
+TRefCountPtr<IPooledRenderTarget> FWil21SkyCache::Find(const FWil21SkyCacheKey& Key, const TRefCountPtr<FRDGPooledBuffer>& InDataRad)
+{
+	check(IsInRenderingThread());
+	SetDataRad(InDataRad);
+	FEntry* Entry = Entries.Find(Key);
+	if (!Entry)
+	{
+		return nullptr;
+	}
+	Entry->LastUsed = ++UseCounter;
+	return Entry->Sky;
+}
+
+void FWil21SkyCache::Add(const FWil21SkyCacheKey& Key, const TRefCountPtr<FRDGPooledBuffer>& InDataRad, TRefCountPtr<IPooledRenderTarget> Sky)
+{
+	check(IsInRenderingThread());
+	const int64 BudgetBytes = int64(CVarWil21SkyCacheBudgetMB.GetValueOnRenderThread()) * 1024 * 1024;
+	if (!Sky.IsValid())
+	{
+		return;
+	}
+	SetDataRad(InDataRad);
+	const FPooledRenderTargetDesc& Desc = Sky->GetDesc();
+	const int64 Bytes = int64(Desc.Extent.X) * Desc.Extent.Y * GPixelFormats[Desc.Format].BlockBytes;
+	if (Bytes > BudgetBytes)
+	{
+		EvictToBudget(BudgetBytes);
+		return;
+	}
+
+	if (FEntry* Existing = Entries.Find(Key))
+	{
+		TotalBytes -= Existing->Bytes;
+		DEC_MEMORY_STAT_BY(STAT_Wil21SkyCache, Existing->Bytes);
+	}
+	FEntry& Entry = Entries.Add(Key);
+	Entry.Sky = MoveTemp(Sky);
+	Entry.Bytes = Bytes;
+	Entry.LastUsed = ++UseCounter;
+	TotalBytes += Bytes;
+	INC_MEMORY_STAT_BY(STAT_Wil21SkyCache, Bytes);
+	EvictToBudget(BudgetBytes);
+}
+
+void FWil21SkyCache::Empty()
+{
+	DEC_MEMORY_STAT_BY(STAT_Wil21SkyCache, TotalBytes);
+	Entries.Empty();
+	TotalBytes = 0;
+}
+
+void FWil21SkyCache::SetDataRad(const TRefCountPtr<FRDGPooledBuffer>& InDataRad)
+{
+	if (DataRad != InDataRad)
+	{
+		Empty();
+		DataRad = InDataRad;
+	}
+}
+
+void FWil21SkyCache::EvictToBudget(int64 BudgetBytes)
+{
+	// A handful of presets at most, a linear scan for the oldest entry is cheaper than maintaining a list
+	while (TotalBytes > BudgetBytes && Entries.Num() > 0)
+	{
+		const TPair<FWil21SkyCacheKey, FEntry>* Oldest = nullptr;
+		for (const TPair<FWil21SkyCacheKey, FEntry>& Pair : Entries)
+		{
+			if (!Oldest || Pair.Value.LastUsed < Oldest->Value.LastUsed)
+			{
+				Oldest = &Pair;
+			}
+		}
+		const int64 Bytes = Oldest->Value.Bytes;
+		Entries.Remove(FWil21SkyCacheKey(Oldest->Key));
+		TotalBytes -= Bytes;
+		DEC_MEMORY_STAT_BY(STAT_Wil21SkyCache, Bytes);
+	}
+}
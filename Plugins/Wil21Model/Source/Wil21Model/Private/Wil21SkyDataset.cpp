@@ -0,0 +1,321 @@
+#include "Wil21SkyDataset.h"
+#include "Wil21DatasetIndex.h"
+#include "Wil21Memory.h"
+#include "Async/Async.h"
+#include "HAL/PlatformFilemanager.h"
+#include "Misc/Paths.h"
+#include "Serialization/CustomVersion.h"
+
+namespace
+{
+	// Layout of UWil21SkyDataset::Serialize, add an entry before changing it
+	struct FWil21SkyDatasetVersion
+	{
+		enum Type
+		{
+			// Same layout as Initial, saved before the version was registered
+			BeforeCustomVersionWasAdded = 0,
+			Initial,
+
+			VersionPlusOne,
+			LatestVersion = VersionPlusOne - 1
+		};
+	};
+	const FGuid Wil21SkyDatasetVersionGuid(0xD0798F6C, 0x307C4B29, 0x9703F771, 0xFBC0B90A);
+	FCustomVersionRegistration GRegisterWil21SkyDatasetVersion(Wil21SkyDatasetVersionGuid, FWil21SkyDatasetVersion::LatestVersion, TEXT("Wil21SkyDatasetVer"));
+
+	// One in-flight LoadSlicesAsync call, shared by the bulk data callbacks, the decode task and the game thread
+	struct FWil21SliceLoad
+	{
+		FRadianceData Radiance;
+		int64 SliceBytes = 0;
+		TArray<IBulkDataIORequest*> Requests;
+		TArray<uint8*> Results;
+		FThreadSafeCounter Pending;
+		FWil21OnSlicesLoaded OnLoaded;
+		bool bDecodeCoefficients = false;
+
+		~FWil21SliceLoad()
+		{
+			for (uint8* Result : Results)
+			{
+				FMemory::Free(Result);
+			}
+		}
+	};
+	using FWil21SliceLoadRef = TSharedRef<FWil21SliceLoad, ESPMode::ThreadSafe>;
+
+	// Slices hold [Albedo][Configs] per visibility/altitude, DataRad wants visibility, albedo, altitude order.
+	// OutRawDataRad, when set, receives the configurations undecoded in the same order, DataRad their doubles only with bDecode.
+	// False when the selection is too large to hold.
+	bool DecodeSlices(FRadianceData& Radiance, int64 SliceBytes, TConstArrayView<uint8*> SliceData, TArray<uint32>* OutRawDataRad, bool bDecode)
+	{
+		const int ConfigsPerAltitude = Radiance.Channels * Radiance.ElevationsRad.Num();
+		const int64 AlbedoBytes = SliceBytes / Radiance.AlbedosRad.Num();
+		const int64 CoefsPerAltitude = int64(ConfigsPerAltitude) * Radiance.MetadataRad.TotalCoefsSingleConfig;
+		const int64 BlockCount = int64(Radiance.VisibilitiesRad.Num()) * Radiance.AlbedosRad.Num() * Radiance.AltitudesRad.Num();
+		if (!UWil21BlueprintLibrary::IsRadianceSizeSupported(CoefsPerAltitude * BlockCount, AlbedoBytes * BlockCount))
+		{
+			return false;
+		}
+		Radiance.MetadataRad.TotalCoefsAllConfigs = int32(CoefsPerAltitude * BlockCount);
+		Radiance.DataRad.Empty();
+		if (bDecode)
+		{
+			Radiance.DataRad.SetNum(Radiance.MetadataRad.TotalCoefsAllConfigs);
+		}
+		uint8* RawOut = nullptr;
+		if (OutRawDataRad)
+		{
+			OutRawDataRad->SetNumZeroed(FMath::DivideAndRoundUp<int64>(AlbedoBytes * BlockCount, sizeof(uint32)));
+			RawOut = reinterpret_cast<uint8*>(OutRawDataRad->GetData());
+		}
+
+		double* Out = Radiance.DataRad.GetData();
+		for (int Vis = 0; Vis < Radiance.VisibilitiesRad.Num(); ++Vis)
+		{
+			for (int Alb = 0; Alb < Radiance.AlbedosRad.Num(); ++Alb)
+			{
+				for (int Alt = 0; Alt < Radiance.AltitudesRad.Num(); ++Alt)
+				{
+					const uint8* Slice = SliceData[Vis * Radiance.AltitudesRad.Num() + Alt];
+					if (bDecode)
+					{
+						UWil21BlueprintLibrary::DecodeRadianceConfigs(Slice + AlbedoBytes * Alb, ConfigsPerAltitude, Radiance.MetadataRad, Out);
+						Out += CoefsPerAltitude;
+					}
+					if (RawOut)
+					{
+						FMemory::Memcpy(RawOut, Slice + AlbedoBytes * Alb, AlbedoBytes);
+						RawOut += AlbedoBytes;
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+	void FinishSliceLoad(FWil21SliceLoadRef Load)
+	{
+		LLM_SCOPE_BYTAG(Wil21Model);
+		FSkyModelData SkyModelData;
+		SkyModelData.RadianceData = Load->Radiance;
+		FRadianceData& Radiance = SkyModelData.RadianceData;
+
+		FShaderPackedData ShaderPackedData;
+		if (Load->Results.Num() > 0 && !Load->Results.Contains(nullptr))
+		{
+			TArray<uint32> RawDataRad;
+			if (DecodeSlices(Radiance, Load->SliceBytes, Load->Results, &RawDataRad, Load->bDecodeCoefficients))
+			{
+				ShaderPackedData = UWil21BlueprintLibrary::PackRadianceData(Radiance, MoveTemp(RawDataRad));
+			}
+		}
+
+		AsyncTask(ENamedThreads::GameThread, [Load, SkyModelData = MoveTemp(SkyModelData), ShaderPackedData = MoveTemp(ShaderPackedData)]() mutable
+		{
+			// Requests own the callbacks that keep Load alive, so they are released here once everything has completed
+			for (IBulkDataIORequest* Request : Load->Requests)
+			{
+				if (Request)
+				{
+					Request->WaitCompletion();
+					delete Request;
+				}
+			}
+			Load->Requests.Empty();
+			Load->OnLoaded(SkyModelData, ShaderPackedData);
+		});
+	}
+}
+
+void UWil21SkyDataset::Serialize(FArchive& Ar)
+{
+	Super::Serialize(Ar);
+	Ar.UsingCustomVersion(Wil21SkyDatasetVersionGuid);
+	if (Ar.IsLoading() && Ar.CustomVer(Wil21SkyDatasetVersionGuid) > FWil21SkyDatasetVersion::LatestVersion)
+	{
+		UE_LOG(LogTemp, Error, TEXT("%s was saved by a newer version of the Wil21Model plugin"), *GetName());
+		Ar.SetError();
+		return;
+	}
+
+	FRadianceMetadata& Metadata = Header.MetadataRad;
+	Ar << Header.VisibilitiesInFile << Header.AlbedosRad << Header.AltitudesInFile << Header.ElevationsRad;
+	Ar << Header.Channels << Header.ChannelStart << Header.ChannelWidth;
+	Ar << Metadata.Rank << Metadata.SunBreaks << Metadata.ZenithBreaks << Metadata.EmphBreaks;
+
+	int32 SliceCount = Slices.Num();
+	Ar << SliceCount;
+	if (Ar.IsLoading())
+	{
+		// A slice per visibility and altitude, anything else is a damaged asset whose count must not size the allocation
+		const int64 ExpectedSlices = int64(Header.VisibilitiesInFile.Num()) * Header.AltitudesInFile.Num();
+		if (SliceCount != ExpectedSlices)
+		{
+			UE_LOG(LogTemp, Error, TEXT("%s holds %d slices, its header needs %lld"), *GetName(), SliceCount, ExpectedSlices);
+			Header = FRadianceData();
+			Slices.Empty();
+			Ar.SetError();
+			return;
+		}
+		UWil21BlueprintLibrary::ComputeRadianceStrides(Metadata);
+		Slices.Empty(SliceCount);
+		for (int32 SliceIdx = 0; SliceIdx < SliceCount; ++SliceIdx)
+		{
+			Slices.Add(new FByteBulkData());
+		}
+	}
+	for (int32 SliceIdx = 0; SliceIdx < Slices.Num(); ++SliceIdx)
+	{
+		Slices[SliceIdx].Serialize(Ar, this, SliceIdx);
+	}
+}
+
+#if WITH_EDITOR
+bool UWil21SkyDataset::ImportFromFile(const FString& FilePath)
+{
+	TUniquePtr<IFileHandle> Handle(FPlatformFileManager::Get().GetPlatformFile().OpenRead(*FilePath));
+	FWil21DatasetIndex Index;
+	FRadianceData NewHeader;
+	if (!Handle || !FWil21DatasetIndex::LoadOrBuild(FilePath, Handle.Get(), Index) ||
+		!Handle->Seek(Index.RadianceHeaderOffset) || !UWil21BlueprintLibrary::ReadRadianceHeader(Handle.Get(), NewHeader))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Failed to read dataset header: %s"), *FilePath);
+		return false;
+	}
+
+	const int64 AltitudeSliceBytes = Index.GetAltitudeSliceBytes();
+	TIndirectArray<FByteBulkData> NewSlices;
+	for (int32 Vis = 0; Vis < Index.VisibilityCount; ++Vis)
+	{
+		for (int32 Alt = 0; Alt < Index.AltitudeCount; ++Alt)
+		{
+			FByteBulkData* Slice = new FByteBulkData();
+			NewSlices.Add(Slice);
+			// Every slice is its own payload so it can be streamed without the rest
+			Slice->SetBulkDataFlags(BULKDATA_Force_NOT_InlinePayload);
+			Slice->Lock(LOCK_READ_WRITE);
+			uint8* Dest = (uint8*)Slice->Realloc(AltitudeSliceBytes * Index.AlbedoCount);
+			bool bRead = true;
+			for (int32 Alb = 0; Alb < Index.AlbedoCount && bRead; ++Alb)
+			{
+				bRead = Handle->Seek(Index.GetAltitudeSliceOffset(Vis, Alb, Alt)) && Handle->Read(Dest + AltitudeSliceBytes * Alb, AltitudeSliceBytes);
+			}
+			Slice->Unlock();
+			if (!bRead)
+			{
+				UE_LOG(LogTemp, Error, TEXT("Unexpected end of file in radiance data: %s"), *FilePath);
+				return false;
+			}
+		}
+	}
+
+	FTransmittanceData NewTransmittance;
+	if (Index.HasTransmittance() && !UWil21BlueprintLibrary::ReadTransmittanceFile(Handle.Get(), Index, NewHeader.Channels, NewTransmittance))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Failed to read transmittance data: %s"), *FilePath);
+		NewTransmittance = FTransmittanceData();
+	}
+
+	SourceFile = FPaths::GetCleanFilename(FilePath);
+	Header = MoveTemp(NewHeader);
+	TransmittanceData = MoveTemp(NewTransmittance);
+	Slices = MoveTemp(NewSlices);
+	return true;
+}
+#endif
+
+bool UWil21SkyDataset::LoadSlices(double SingleVisibility, double SingleAltitude, FRadianceData& OutRadiance, TArray<uint32>* OutRawDataRad)
+{
+	LLM_SCOPE_BYTAG(Wil21Model);
+	OutRadiance = Header;
+	const int64 SliceBytes = UWil21BlueprintLibrary::GetRadianceConfigByteCount(Header.MetadataRad) * Header.Channels * Header.ElevationsRad.Num() * Header.AlbedosRad.Num();
+	const int32 SkippedVisibilities = UWil21BlueprintLibrary::SelectBracket(Header.VisibilitiesInFile, SingleVisibility > 0.0, SingleVisibility, OutRadiance.VisibilitiesRad);
+	const int32 SkippedAltitudes = UWil21BlueprintLibrary::SelectBracket(Header.AltitudesInFile, SingleAltitude >= 0.0, SingleAltitude, OutRadiance.AltitudesRad);
+
+	TArray<uint8*> SliceData;
+	bool bLoaded = true;
+	for (int32 Vis = 0; Vis < OutRadiance.VisibilitiesRad.Num() && bLoaded; ++Vis)
+	{
+		for (int32 Alt = 0; Alt < OutRadiance.AltitudesRad.Num() && bLoaded; ++Alt)
+		{
+			const int32 SliceIdx = GetSliceIndex(SkippedVisibilities + Vis, SkippedAltitudes + Alt);
+			uint8* Data = nullptr;
+			bLoaded = Slices.IsValidIndex(SliceIdx) && Slices[SliceIdx].GetBulkDataSize() == SliceBytes;
+			if (bLoaded)
+			{
+				// Keeps the bulk data unloaded, only the copy is decoded
+				Slices[SliceIdx].GetCopy(reinterpret_cast<void**>(&Data), false);
+				bLoaded = Data != nullptr;
+			}
+			SliceData.Add(Data);
+		}
+	}
+	bLoaded = bLoaded && SliceData.Num() > 0 && DecodeSlices(OutRadiance, SliceBytes, SliceData, OutRawDataRad, true);
+	if (!bLoaded)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Failed to load slices of %s"), *GetName());
+	}
+	for (uint8* Data : SliceData)
+	{
+		FMemory::Free(Data);
+	}
+	return bLoaded;
+}
+
+void UWil21SkyDataset::LoadSlicesAsync(double SingleVisibility, double SingleAltitude, FWil21OnSlicesLoaded OnLoaded, bool bDecodeCoefficients)
+{
+	check(IsInGameThread());
+
+	FWil21SliceLoadRef Load = MakeShared<FWil21SliceLoad, ESPMode::ThreadSafe>();
+	Load->Radiance = Header;
+	Load->SliceBytes = UWil21BlueprintLibrary::GetRadianceConfigByteCount(Header.MetadataRad) * Header.Channels * Header.ElevationsRad.Num() * Header.AlbedosRad.Num();
+	Load->OnLoaded = MoveTemp(OnLoaded);
+	Load->bDecodeCoefficients = bDecodeCoefficients;
+	const int32 SkippedVisibilities = UWil21BlueprintLibrary::SelectBracket(Header.VisibilitiesInFile, SingleVisibility > 0.0, SingleVisibility, Load->Radiance.VisibilitiesRad);
+	const int32 SkippedAltitudes = UWil21BlueprintLibrary::SelectBracket(Header.AltitudesInFile, SingleAltitude >= 0.0, SingleAltitude, Load->Radiance.AltitudesRad);
+
+	TArray<int32> SliceIndices;
+	for (int32 Vis = 0; Vis < Load->Radiance.VisibilitiesRad.Num(); ++Vis)
+	{
+		for (int32 Alt = 0; Alt < Load->Radiance.AltitudesRad.Num(); ++Alt)
+		{
+			SliceIndices.Add(GetSliceIndex(SkippedVisibilities + Vis, SkippedAltitudes + Alt));
+		}
+	}
+	Load->Results.SetNumZeroed(SliceIndices.Num());
+	Load->Pending.Set(SliceIndices.Num());
+	if (SliceIndices.Num() == 0)
+	{
+		FinishSliceLoad(Load);
+		return;
+	}
+
+	for (int32 RequestIdx = 0; RequestIdx < SliceIndices.Num(); ++RequestIdx)
+	{
+		IBulkDataIORequest* Request = nullptr;
+		const int32 SliceIdx = SliceIndices[RequestIdx];
+		if (Slices.IsValidIndex(SliceIdx) && Slices[SliceIdx].GetBulkDataSize() == Load->SliceBytes)
+		{
+			FBulkDataIORequestCallBack Callback = [Load, RequestIdx](bool bWasCancelled, IBulkDataIORequest* InRequest)
+			{
+				Load->Results[RequestIdx] = bWasCancelled ? nullptr : InRequest->GetReadResults();
+				if (Load->Pending.Decrement() == 0)
+				{
+					Async(EAsyncExecution::ThreadPool, [Load]() { FinishSliceLoad(Load); });
+				}
+			};
+			Request = Slices[SliceIdx].CreateStreamingRequest(AIOP_Normal, &Callback, nullptr);
+		}
+		if (!Request)
+		{
+			UE_LOG(LogTemp, Error, TEXT("Failed to stream slice %d of %s"), SliceIdx, *GetName());
+			if (Load->Pending.Decrement() == 0)
+			{
+				Async(EAsyncExecution::ThreadPool, [Load]() { FinishSliceLoad(Load); });
+			}
+		}
+		Load->Requests.Add(Request);
+	}
+}
@@ -0,0 +1,226 @@
+#include "Wil21SunTransmittance.h"
+#include "Wil21Spectrum.h"
+
+namespace
+{
+	constexpr double PlanetRadius = 6378000.0;
+	constexpr double AtmosphereWidth = 100000.0;
+	constexpr double SafetyAltitude = 50.0;
+
+	struct FTransInterpolation
+	{
+		int32 Index = 0;
+		double Factor = 0.0;
+	};
+
+	// Interpolation within a list of breakpoints (visibilities, altitudes).
+	FTransInterpolation GetBreakInterpolation(const TArray<double>& Breaks, double Value)
+	{
+		FTransInterpolation Result;
+		if (Breaks.Num() < 2)
+		{
+			return Result;
+		}
+		const double Clamped = FMath::Clamp(Value, Breaks[0], Breaks.Last());
+		int32 Index = 1;
+		while (Index < Breaks.Num() - 1 && Breaks[Index] <= Clamped)
+		{
+			++Index;
+		}
+		Result.Index = Index - 1;
+		Result.Factor = FMath::Clamp((Clamped - Breaks[Index - 1]) / (Breaks[Index] - Breaks[Index - 1]), 0.0, 1.0);
+		return Result;
+	}
+
+	// Interpolation within the regular transmittance grid, whose nodes are uniform in Value^(1/Power).
+	FTransInterpolation GetGridInterpolation(double Value, int32 Count, int32 Power)
+	{
+		FTransInterpolation Result;
+		if (Count < 2)
+		{
+			return Result;
+		}
+		const double Scaled = FMath::Pow(FMath::Clamp(Value, 0.0, 1.0), 1.0 / Power) * (Count - 1);
+		Result.Index = FMath::Min((int32)Scaled, Count - 2);
+		Result.Factor = FMath::Clamp(Scaled - Result.Index, 0.0, 1.0);
+		return Result;
+	}
+
+	// Maps a ray (zenith angle and length) to the normalised grid coordinates of the fit. Returns false if the ray hits the planet.
+	bool ToTransmittanceCoords(double Theta, double Distance, double Altitude, double& OutA, double& OutD)
+	{
+		const double R0 = PlanetRadius + FMath::Max(Altitude, 0.0) + SafetyAltitude;
+		const double CosTheta = FMath::Cos(Theta);
+		const double B = R0 * CosTheta;
+
+		const double PlanetDisc = B * B - R0 * R0 + PlanetRadius * PlanetRadius;
+		if (CosTheta < 0.0 && PlanetDisc >= 0.0)
+		{
+			return false;
+		}
+
+		const double EdgeRadius = PlanetRadius + AtmosphereWidth;
+		const double DistanceToEdge = -B + FMath::Sqrt(FMath::Max(B * B - R0 * R0 + EdgeRadius * EdgeRadius, 0.0));
+
+		OutA = 0.5 * (1.0 - CosTheta);
+		OutD = (Distance <= 0.0 || DistanceToEdge <= 0.0) ? 1.0 : FMath::Min(Distance / DistanceToEdge, 1.0);
+		return true;
+	}
+
+	double ReconstructTransmittance(const FTransmittanceData& Data, int32 Channels, int32 VisibilityIdx, int32 AltitudeIdx, int32 AIdx, int32 DIdx, int32 Channel)
+	{
+		const int32 Rank = Data.RankTrans;
+		const int64 UOffset = ((int64(AltitudeIdx) * Data.ADim + AIdx) * Data.DDim + DIdx) * Rank;
+		const int64 VOffset = ((int64(VisibilityIdx) * Data.AltitudesTrans.Num() + AltitudeIdx) * Channels + Channel) * Rank;
+
+		double Result = 0.0;
+		for (int32 R = 0; R < Rank; ++R)
+		{
+			Result += double(Data.DataTransU[UOffset + R]) * double(Data.DataTransV[VOffset + R]);
+		}
+		return FMath::Max(Result, 0.0);
+	}
+
+	double InterpolateGrid(const FTransmittanceData& Data, int32 Channels, int32 VisibilityIdx, int32 AltitudeIdx, const FTransInterpolation& AParam, const FTransInterpolation& DParam, int32 Channel)
+	{
+		const int32 ANext = FMath::Min(AParam.Index + 1, Data.ADim - 1);
+		const int32 DNext = FMath::Min(DParam.Index + 1, Data.DDim - 1);
+		const double T00 = ReconstructTransmittance(Data, Channels, VisibilityIdx, AltitudeIdx, AParam.Index, DParam.Index, Channel);
+		const double T10 = ReconstructTransmittance(Data, Channels, VisibilityIdx, AltitudeIdx, ANext, DParam.Index, Channel);
+		const double T01 = ReconstructTransmittance(Data, Channels, VisibilityIdx, AltitudeIdx, AParam.Index, DNext, Channel);
+		const double T11 = ReconstructTransmittance(Data, Channels, VisibilityIdx, AltitudeIdx, ANext, DNext, Channel);
+		const double T0 = FMath::Lerp(T00, T10, AParam.Factor);
+		const double T1 = FMath::Lerp(T01, T11, AParam.Factor);
+		// The fit stores the square root of transmittance
+		const double Sqrt = FMath::Lerp(T0, T1, DParam.Factor);
+		return Sqrt * Sqrt;
+	}
+
+	bool HasTransmittance(const FTransmittanceData& Data, int32 Channels)
+	{
+		return Channels > 0 && Data.RankTrans > 0 && Data.ADim > 0 && Data.DDim > 0
+			&& Data.VisibilitiesTrans.Num() > 0 && Data.AltitudesTrans.Num() > 0
+			&& Data.DataTransU.Num() == Data.DDim * Data.ADim * Data.RankTrans * Data.AltitudesTrans.Num()
+			&& Data.DataTransV.Num() == Data.VisibilitiesTrans.Num() * Data.RankTrans * Channels * Data.AltitudesTrans.Num();
+	}
+}
+
+double FWil21SunTransmittanceLUT::EvaluateTransmittance(const FTransmittanceData& TransmittanceData, int32 Channels, int32 Channel, double Theta, double Distance, double Visibility, double Altitude)
+{
+	if (!HasTransmittance(TransmittanceData, Channels) || Channel < 0 || Channel >= Channels)
+	{
+		return 0.0;
+	}
+
+	double A, D;
+	if (!ToTransmittanceCoords(Theta, Distance, Altitude, A, D))
+	{
+		return 0.0;
+	}
+	const FTransInterpolation AParam = GetGridInterpolation(A, TransmittanceData.ADim, 3);
+	const FTransInterpolation DParam = GetGridInterpolation(D, TransmittanceData.DDim, 4);
+	const FTransInterpolation VisibilityParam = GetBreakInterpolation(TransmittanceData.VisibilitiesTrans, Visibility);
+	const FTransInterpolation AltitudeParam = GetBreakInterpolation(TransmittanceData.AltitudesTrans, Altitude);
+
+	const int32 VisibilityNext = FMath::Min(VisibilityParam.Index + 1, TransmittanceData.VisibilitiesTrans.Num() - 1);
+	const int32 AltitudeNext = FMath::Min(AltitudeParam.Index + 1, TransmittanceData.AltitudesTrans.Num() - 1);
+
+	const double T00 = InterpolateGrid(TransmittanceData, Channels, VisibilityParam.Index, AltitudeParam.Index, AParam, DParam, Channel);
+	const double T10 = InterpolateGrid(TransmittanceData, Channels, VisibilityNext, AltitudeParam.Index, AParam, DParam, Channel);
+	const double T01 = InterpolateGrid(TransmittanceData, Channels, VisibilityParam.Index, AltitudeNext, AParam, DParam, Channel);
+	const double T11 = InterpolateGrid(TransmittanceData, Channels, VisibilityNext, AltitudeNext, AParam, DParam, Channel);
+	return FMath::Lerp(FMath::Lerp(T00, T10, VisibilityParam.Factor), FMath::Lerp(T01, T11, VisibilityParam.Factor), AltitudeParam.Factor);
+}
+
+void FWil21SunTransmittanceLUT::Build(const FSkyModelData& SkyModelData, int32 InElevationCount)
+{
+	const FRadianceData& RadianceData = SkyModelData.RadianceData;
+	const FTransmittanceData& TransmittanceData = SkyModelData.TransmittanceData;
+
+	Colors.Reset();
+	Visibilities.Reset();
+	Altitudes.Reset();
+	ElevationCount = 0;
+
+	if (!HasTransmittance(TransmittanceData, RadianceData.Channels))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("No transmittance data loaded, sun transmittance LUT not built"));
+		return;
+	}
+
+	const TArray<FVector3d> ChannelToRGB = Wil21Spectrum::ComputeChannelToRGB(RadianceData.Channels, RadianceData.ChannelStart, RadianceData.ChannelWidth);
+	FVector3d WhiteRGB = FVector3d::ZeroVector;
+	for (const FVector3d& Weight : ChannelToRGB)
+	{
+		WhiteRGB += Weight;
+	}
+
+	ElevationCount = FMath::Max(InElevationCount, 2);
+	ElevationMin = RadianceData.ElevationsRad.Num() > 0 ? RadianceData.ElevationsRad[0] : -4.2;
+	ElevationMax = RadianceData.ElevationsRad.Num() > 0 ? RadianceData.ElevationsRad.Last() : 90.0;
+	Visibilities = TransmittanceData.VisibilitiesTrans;
+	Altitudes = TransmittanceData.AltitudesTrans;
+	Colors.SetNumUninitialized(Altitudes.Num() * Visibilities.Num() * ElevationCount);
+
+	const int32 Channels = RadianceData.Channels;
+	for (int32 AltitudeIdx = 0; AltitudeIdx < Altitudes.Num(); ++AltitudeIdx)
+	{
+		for (int32 VisibilityIdx = 0; VisibilityIdx < Visibilities.Num(); ++VisibilityIdx)
+		{
+			for (int32 ElevationIdx = 0; ElevationIdx < ElevationCount; ++ElevationIdx)
+			{
+				const double Elevation = FMath::Lerp(ElevationMin, ElevationMax, double(ElevationIdx) / (ElevationCount - 1));
+				const double Theta = FMath::DegreesToRadians(90.0 - Elevation);
+
+				double A, D;
+				FVector3d RGB = FVector3d::ZeroVector;
+				if (ToTransmittanceCoords(Theta, 0.0, Altitudes[AltitudeIdx], A, D))
+				{
+					const FTransInterpolation AParam = GetGridInterpolation(A, TransmittanceData.ADim, 3);
+					const FTransInterpolation DParam = GetGridInterpolation(D, TransmittanceData.DDim, 4);
+					for (int32 Channel = 0; Channel < Channels; ++Channel)
+					{
+						RGB += ChannelToRGB[Channel] * InterpolateGrid(TransmittanceData, Channels, VisibilityIdx, AltitudeIdx, AParam, DParam, Channel);
+					}
+				}
+
+				FLinearColor& Color = Colors[(AltitudeIdx * Visibilities.Num() + VisibilityIdx) * ElevationCount + ElevationIdx];
+				Color.R = WhiteRGB.X > 0.0 ? float(FMath::Max(RGB.X / WhiteRGB.X, 0.0)) : 0.0f;
+				Color.G = WhiteRGB.Y > 0.0 ? float(FMath::Max(RGB.Y / WhiteRGB.Y, 0.0)) : 0.0f;
+				Color.B = WhiteRGB.Z > 0.0 ? float(FMath::Max(RGB.Z / WhiteRGB.Z, 0.0)) : 0.0f;
+				Color.A = 1.0f;
+			}
+		}
+	}
+}
+
+FLinearColor FWil21SunTransmittanceLUT::Fetch(int32 AltitudeIdx, int32 VisibilityIdx, int32 ElevationIdx) const
+{
+	return Colors[(AltitudeIdx * Visibilities.Num() + VisibilityIdx) * ElevationCount + ElevationIdx];
+}
+
+FLinearColor FWil21SunTransmittanceLUT::Sample(double SolarElevationDeg, double Visibility, double Altitude) const
+{
+	if (!IsValid())
+	{
+		return FLinearColor::White;
+	}
+
+	const double ElevationPos = FMath::Clamp((SolarElevationDeg - ElevationMin) / (ElevationMax - ElevationMin), 0.0, 1.0) * (ElevationCount - 1);
+	const int32 E0 = FMath::Min((int32)ElevationPos, ElevationCount - 2);
+	const float EFactor = float(ElevationPos - E0);
+
+	const FTransInterpolation VisibilityParam = GetBreakInterpolation(Visibilities, Visibility);
+	const FTransInterpolation AltitudeParam = GetBreakInterpolation(Altitudes, Altitude);
+	const int32 V1 = FMath::Min(VisibilityParam.Index + 1, Visibilities.Num() - 1);
+	const int32 A1 = FMath::Min(AltitudeParam.Index + 1, Altitudes.Num() - 1);
+
+	auto SampleSlice = [&](int32 AltitudeIdx, int32 VisibilityIdx)
+	{
+		return FMath::Lerp(Fetch(AltitudeIdx, VisibilityIdx, E0), Fetch(AltitudeIdx, VisibilityIdx, E0 + 1), EFactor);
+	};
+
+	const FLinearColor C0 = FMath::Lerp(SampleSlice(AltitudeParam.Index, VisibilityParam.Index), SampleSlice(AltitudeParam.Index, V1), float(VisibilityParam.Factor));
+	const FLinearColor C1 = FMath::Lerp(SampleSlice(A1, VisibilityParam.Index), SampleSlice(A1, V1), float(VisibilityParam.Factor));
+	return FMath::Lerp(C0, C1, float(AltitudeParam.Factor));
+}
@@ -6,6 +6,8 @@
 #include "Kismet/BlueprintFunctionLibrary.h"
 #include "DatProcessor.generated.h"
 
+struct FWil21DatasetIndex;
+
 USTRUCT(BlueprintType, meta = (ScriptName = "Wil21Model"))
 struct FRadianceMetadata
 {
@@ -36,12 +38,20 @@ struct FRadianceData
 
 	UPROPERTY(BlueprintReadOnly, Category = "Radiance Data")  
 	TArray<double> VisibilitiesRad;  
+
+	// Every visibility in the dataset, VisibilitiesRad only holds the loaded slices
+	UPROPERTY(BlueprintReadOnly, Category = "Radiance Data")  
+	TArray<double> VisibilitiesInFile;  
     
 	UPROPERTY(BlueprintReadOnly, Category = "Radiance Data")  
 	TArray<double> AlbedosRad;  
     
 	UPROPERTY(BlueprintReadOnly, Category = "Radiance Data")  
 	TArray<double> AltitudesRad;  
+
+	// Every altitude in the dataset, AltitudesRad only holds the loaded slices
+	UPROPERTY(BlueprintReadOnly, Category = "Radiance Data")  
+	TArray<double> AltitudesInFile;  
     
 	UPROPERTY(BlueprintReadOnly, Category = "Radiance Data")  
 	TArray<double> ElevationsRad;  
@@ -99,6 +109,9 @@ struct FSkyModelData
 	FTransmittanceData TransmittanceData;
 };
 
+// The sky and decode shaders address the decoded coefficient buffer with 32 bit byte offsets
+constexpr int64 Wil21MaxDataRadBytes = MAX_uint32;
+
 struct DoublePacked
 {
 	uint32 Low;
@@ -139,8 +152,22 @@ struct FShaderPackedData
 	int32 AltitudesRadSize;
 	UPROPERTY(BlueprintReadOnly, Category = "Sky Model")
 	int32 ElevationsRadSize;
+	// uint32s of the decoded coefficient buffer, two per double; 0 when it would exceed Wil21MaxDataRadBytes
 	UPROPERTY(BlueprintReadOnly, Category = "Sky Model")
 	int32 DataRadSize;
+	// Bytes of one configuration in RawDataRad
+	int32 RawConfigBytes = 0;
+	// Rank stored in RawDataRad; Rank is lower when the trailing rank terms are left out of DataRad, see TruncateRank
+	int32 SourceRank = 0;
+	// Relative error of keeping only the first K rank terms at index K - 1, worst colour channel, see ComputeRankTruncationErrors
+	TArray<float> RankTruncationErrors;
+	// DataRad holds double-float pairs for the WIL21_DF64 shaders instead of doubles, set when it is uploaded
+	bool bDf64Coefficients = false;
+	// Channels per configuration, as in the dataset header
+	UPROPERTY(BlueprintReadOnly, Category = "Sky Model")
+	int32 Channels = 0;
+	// One entry per channel with a non-zero colour weight: xyz is the linear sRGB weight, w the channel index
+	TArray<FVector4f> ChannelWeights;
 
 	TArray<DoublePacked> SunBreaks;
 	TArray<DoublePacked> ZenithBreaks;
@@ -149,7 +176,9 @@ struct FShaderPackedData
 	TArray<DoublePacked> AlbedosRad;
 	TArray<DoublePacked> AltitudesRad;
 	TArray<DoublePacked> ElevationsRad;
-	TArray<uint32> DataRad;
+	// Radiance configurations exactly as stored in the file (fp16 with a double zenith scale per rank), in DataRad order and
+	// padded to whole uint32s. Uploaded as-is and expanded to doubles on the GPU, see CreateWil21CoefficientBuffer.
+	TArray<uint32> RawDataRad;
 	// TArray<uint32> SpectralResponse;
 };  
 
@@ -157,7 +186,8 @@ USTRUCT(BlueprintType)
 struct FShaderControlData  
 {
 	GENERATED_BODY()
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "ShaderControl") 
+	// Width of the generated panorama in pixels
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "ShaderControl", meta = (ClampMin = "16", ClampMax = "8192"))
 	int32 Resolution = 1024;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, interp, Category = "ShaderControl", meta = (ClampMin = "-4.2", ClampMax = "90.0", UIMin = "-4.2", UIMax = "90.0"))
 	float SolarElevation = -4.2f;
@@ -167,16 +197,26 @@ struct FShaderControlData
 	float Albedo = 0.5f;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, interp, Category = "ShaderControl", meta = (ClampMin = "27.0", ClampMax = "131.8", UIMin = "27.0", UIMax = "131.8"))
 	float Visibility = 131.8f;
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "ShaderControl")
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, interp, Category = "ShaderControl", meta = (ClampMin = "0.0", UIMin = "0.0", UIMax = "15000.0"))
 	float Altitude = 0.0f;
+	// Write a sky-view LUT instead of the panorama: elevation concentrated at the horizon and azimuth measured from the sun,
+	// sampled with Wil21SampleSkyViewLUT from Shaders/Private/Wil21SkyViewLUT.ush
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "ShaderControl")
+	bool bSkyViewLUT = false;
 	bool operator==(const FShaderControlData& Other) const  
 	{  
-		return Resolution == Other.Resolution && SolarElevation == Other.SolarElevation && SolarAzimuth == Other.SolarAzimuth && Albedo == Other.Albedo && Visibility == Other.Visibility && Altitude == Other.Altitude; 
+		return Resolution == Other.Resolution && SolarElevation == Other.SolarElevation && SolarAzimuth == Other.SolarAzimuth && Albedo == Other.Albedo && Visibility == Other.Visibility && Altitude == Other.Altitude
+			&& bSkyViewLUT == Other.bSkyViewLUT; 
 	}  
 	bool operator!=(const FShaderControlData& Other) const  
 	{  
 		return !(*this == Other);  
 	}  
+	// True when everything but the sun position matches, i.e. the sky only moved with the sun
+	bool HasSameAtmosphere(const FShaderControlData& Other) const
+	{
+		return Resolution == Other.Resolution && Albedo == Other.Albedo && Visibility == Other.Visibility && Altitude == Other.Altitude && bSkyViewLUT == Other.bSkyViewLUT;
+	}
 };  
 
 UCLASS(MinimalAPI, meta = (ScriptName = "Wil21Model"))
@@ -186,10 +226,33 @@ class UWil21BlueprintLibrary : public UBlueprintFunctionLibrary
 public:
 	
 	UFUNCTION(BlueprintCallable, Category = "Wil21Model")  
-	static FShaderPackedData ReadDatFileFromContentFolder(FSkyModelData& SkyModelData, const FString& FileName = "SkyModelDatasetGround.dat", double SingleVisibility =23.8); 
+	static FShaderPackedData ReadDatFileFromContentFolder(FSkyModelData& SkyModelData, const FString& FileName = "SkyModelDatasetGround.dat", double SingleVisibility =23.8, double SingleAltitude = -1.0, bool bLoadTransmittance = true, bool bDecodeCoefficients = true); 
+	// Reads only the transmittance block, for loading it lazily once the sun colour is needed
+	static bool ReadTransmittanceFromContentFolder(const FString& FileName, int Channels, FTransmittanceData& Result);
+	static FString GetDatasetPath(const FString& FileName);
 	
-	static void ReadRadianceFile(IFileHandle* Handle, double SingleVisibility, FRadianceData& Result);
-	static void ReadTransmittanceFile(IFileHandle* Handle, int Channels, FTransmittanceData& Result); 
+	// Reads the radiance metadata up to the first config, leaving the handle at the start of the config data
+	static bool ReadRadianceHeader(IFileHandle* Handle, FRadianceData& Result);
+	static int64 GetRadianceConfigByteCount(const FRadianceMetadata& Metadata);
+	// Whether a selection decoding to TotalCoefsAllConfigs doubles from RawBytes of configurations fits the shaders and TArray, logs why not
+	static bool IsRadianceSizeSupported(int64 TotalCoefsAllConfigs, int64 RawBytes);
+	static void ComputeRadianceStrides(FRadianceMetadata& Metadata);
+	// Decodes configs stored as in the file into Metadata.TotalCoefsSingleConfig doubles each
+	static void DecodeRadianceConfigs(const uint8* Bytes, int ConfigCount, const FRadianceMetadata& Metadata, double* Out);
+	// Takes over the raw configurations of RadianceData for the GPU, RadianceData.DataRad may be left undecoded
+	static FShaderPackedData PackRadianceData(const FRadianceData& RadianceData, TArray<uint32>&& RawDataRad);
+	// Per channel, the energy weighted relative error of each truncation of the sun x zenith sum over the breakpoint grid,
+	// reduced to the worst channel in ChannelWeights (every channel when empty). Reads the raw configurations one at a time.
+	static TArray<float> ComputeRankTruncationErrors(const FRadianceData& RadianceData, const TArray<uint32>& RawDataRad, const TArray<FVector4f>& ChannelWeights);
+	// Keeps the first KeptRank terms of each configuration, the GPU decode then leaves the others out of DataRad
+	static void TruncateRank(FShaderPackedData& ShaderPackedData, int32 KeptRank);
+	// SingleVisibility <= 0 and SingleAltitude < 0 load every visibility/altitude, otherwise only the two bracketing slices.
+	// OutRawDataRad receives the configurations as read, Result.DataRad their doubles only when bDecodeCoefficients is set.
+	static bool ReadRadianceFile(IFileHandle* Handle, const FWil21DatasetIndex& Index, double SingleVisibility, FRadianceData& Result, double SingleAltitude = -1.0, TArray<uint32>* OutRawDataRad = nullptr, bool bDecodeCoefficients = true);
+	// Picks the one or two values bracketing Query, returns how many values precede the selection
+	static int SelectBracket(const TArray<double>& ValuesInFile, bool bSelect, double Query, TArray<double>& OutSelected);
+	static bool ReadTransmittanceHeader(IFileHandle* Handle, FTransmittanceData& Result);
+	static bool ReadTransmittanceFile(IFileHandle* Handle, const FWil21DatasetIndex& Index, int Channels, FTransmittanceData& Result); 
 	// static void ReadRadiance(IFileHandle* Handle, double SingleVisibility, FRadianceData& RadianceData);
 	static double DoubleFromHalf(uint16 Half);
 	static  TArray<DoublePacked> ConvertDoublesToUint32s(const TArray<double>& doubleArray);
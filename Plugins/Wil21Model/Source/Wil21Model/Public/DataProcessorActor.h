@@ -3,10 +3,19 @@
 #include "GameFramework/Actor.h"
 #include "DatProcessor.h"
 #include "Wil21Rendering.h"
+#include "Wil21RenderScheduler.h"
+#include "Wil21SunTransmittance.h"
+#include "Wil21CpuEvaluator.h"
 
 #include "DataProcessorActor.generated.h"
 
+class ADirectionalLight;
+class UWil21SkyDataset;
+class UTextureRenderTarget2DArray;
+
 DECLARE_DYNAMIC_MULTICAST_DELEGATE(FOnVariableChangedDelegate); 
+// Pixels are row major linear colour, Width x Height
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_FourParams(FOnWil21SkyReadBackDelegate, const FShaderControlData&, Control, int32, Width, int32, Height, const TArray<FLinearColor>&, Pixels);
 UCLASS()
 class ADataProcessor : public AActor
 {
@@ -14,41 +23,162 @@ class ADataProcessor : public AActor
 public:
 	ADataProcessor();
 	UFUNCTION(BlueprintCallable, Category = "Wil21Model")  
-	void ReadDatFileFromContentFolder(const FString& FileName = "SkyModelDatasetGround.dat", double SingleVisibility =23.8); 
+	void ReadDatFileFromContentFolder(const FString& FileName = "SkyModelDatasetGround.dat", double SingleVisibility =23.8, double SingleAltitude = -1.0); 
 	UPROPERTY(BlueprintAssignable, Category="Events")  
 	FOnVariableChangedDelegate OnVariableChangedDelegate;
 	UFUNCTION()  
 	void SetVariable(float SolarElevation,float SolarAzimuth, float Albedo, float Visibility);
 	UFUNCTION()
 	void OnVariableChanged();
+	virtual void Tick(float DeltaSeconds) override;
+	virtual void BeginPlay() override;
+	virtual bool ShouldTickIfViewportsOnly() const override;
+	// Renders one sky per entry of Controls into the matching slice of OutputArray in a single dispatch, e.g. to preview or blend candidate weathers
+	UFUNCTION(BlueprintCallable, Category = "Wil21Model")
+	void RenderSkyBatch(const TArray<FShaderControlData>& Controls, UTextureRenderTarget2DArray* OutputArray);
+	// Sky radiance for arbitrary directions evaluated on the CPU, e.g. for probes or gameplay heuristics.
+	// Callable from any thread: the game thread builds the evaluator on demand, other threads get zeros until it exists
+	UFUNCTION(BlueprintCallable, Category = "Wil21Model")
+	TArray<FLinearColor> QuerySkyRadianceRGB(const TArray<FVector>& Directions, const FShaderControlData& Control) const;
+	// Radiance of every channel per direction, direction major; OutChannelWavelengths holds the channel centres in nm.
+	// Same threading as QuerySkyRadianceRGB, empty off the game thread until the evaluator exists
+	UFUNCTION(BlueprintCallable, Category = "Wil21Model")
+	TArray<double> QuerySkyRadianceSpectra(const TArray<FVector>& Directions, const FShaderControlData& Control, TArray<double>& OutChannelWavelengths) const;
+	// Game thread only. Shared evaluator for the resident slices, safe to use from worker threads once returned; null until
+	// data is loaded. Loads leave the coefficients undecoded, so unless bPrepareCpuEvaluator already built it the first call
+	// after a load re-reads the slices, blocking the game thread.
+	TSharedPtr<const FWil21CpuEvaluator, ESPMode::ThreadSafe> GetCpuEvaluator() const;
+	// Any thread, never blocks on a load: the evaluator of the resident slices if it has been built, null otherwise
+	TSharedPtr<const FWil21CpuEvaluator, ESPMode::ThreadSafe> TryGetCpuEvaluator() const;
+	// Renders the current sky with the fp64 and the double-float shaders, and logs their GPU time and error against the CPU
+	// evaluator. Blocks until done, for choosing r.Wil21.Df64 on a GPU; also the Wil21.CompareDf64 console command.
+	UFUNCTION(BlueprintCallable, Category = "Wil21Model")
+	void CompareDf64(int32 Width = 256, int32 Iterations = 8);
 private:
-	void ReadRadianceFile(IFileHandle* Handle, double SingleVisibility, FRadianceData& Result);
-	
+	void LoadDataset();
 	void OnSliderChangeFinished();
 	void OnSliderUpdate();
-	void InitializePersistentBuffer(TArray<uint32>& DataRad);
-	// Data processing functions
-	double DoubleFromHalf(uint16 Half);
-	TArray<DoublePacked> ConvertDoublesToUint32s(const TArray<double>& doubleArray);
-	void UseRDGComputeWil21(const UObject* WorldContextObject, const FShaderPackedData& ShaderPackedData, const FShaderControlData& ShaderControlData);
-	void PostInitProperties() override;
+	void InitializePersistentBuffer(FShaderPackedData& PackedData);
+	void ReleaseCpuCoefficients();
+	// Builds the evaluator of the resident slices on the thread pool, dropped if another load has started by then
+	void PrepareCpuEvaluator(uint32 Generation);
+	// Altitude whose bracket is the resident altitude slices, -1 when all of them are resident
+	double GetResidentAltitude() const;
+	// Reads the resident visibility and altitude slices again, decoded and, with OutRawDataRad, as stored
+	bool ReloadResidentSlices(FRadianceData& OutRadiance, TArray<uint32>* OutRawDataRad = nullptr) const;
+	void UpdateSunLight();
+	void EnsureSunTransmittanceLoaded();
+	void StreamAltitudeSlicesIfNeeded();
+	void StreamAltitudeSlices();
+	void UpdateLuminanceStats();
+	void UpdateSkyReadback();
+	void OnAltitudeSlicesLoaded(FSkyModelData& NewData, FShaderPackedData& NewPacked);
+	void UseRDGComputeWil21(const UObject* WorldContextObject, const FShaderPackedData& ShaderPackedData, const FShaderControlData& ShaderControlData, bool bPreview = false, bool bTemporal = false);
+	void RequestSkyRender();
+	void EnsureOutputRenderTarget();
+	void OnControlsSettled();
 	// For computing parameters 
 	FShaderPackedData ShaderPackedData;
 	FSkyModelData SkyModelData;
-	FBufferRHIRef DataRadBuffer = nullptr;	
-	FShaderResourceViewRHIRef DataRadSRV = nullptr;
-	TRefCountPtr<FRDGPooledBuffer> DataRadPooledBuffer;  
+	TSharedPtr<FWil21CoefficientBuffer, ESPMode::ThreadSafe> CoefficientBuffer;
+	FWil21SunTransmittanceLUT SunTransmittanceLUT;
+	TSharedRef<FWil21CpuEvaluatorSlot, ESPMode::ThreadSafe> CpuEvaluatorSlot = MakeShared<FWil21CpuEvaluatorSlot, ESPMode::ThreadSafe>();
+	TSharedPtr<FWil21LuminanceReadback, ESPMode::ThreadSafe> LuminanceReadback;
+	TSharedPtr<FWil21SkyReadback, ESPMode::ThreadSafe> SkyReadback;
+	TSharedPtr<FWil21RenderScheduler, ESPMode::ThreadSafe> RenderScheduler;
+	TSharedPtr<FWil21TemporalHistory, ESPMode::ThreadSafe> TemporalHistory;
+	bool bTransmittanceRequested = false;
+
+	// For streaming altitude slices
+	FString LoadedFileName;
+	double LoadedVisibility = 0.0;
+	bool bAltitudeStreamInFlight = false;
+	// Kept rank * 2 + double-float of the last reload for r.Wil21.RankQuality or r.Wil21.Df64, so a failing one is not retried every tick
+	int32 LayoutReloadRequested = 0;
 
 	// For updating slider values
 	FTimerHandle SliderUpdateTimerHandle;  
 	FTimerHandle SliderFinishTimerHandle;  
 	bool bIsSliderChanging = false;  
+	double LastControlChangeTime = -1.0;
+	FShaderControlData LastRequestedControl;
+	FTimerHandle RefineTimerHandle;
 
 public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "ShaderControl")  
 	FShaderControlData ShaderControlData;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "ShaderControl")  
 	UTextureRenderTarget2D* OutputRenderTarget;
+	// Imported dataset asset, streamed slice by slice; the raw .dat in the plugin content folder is used when unset
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "ShaderControl")
+	UWil21SkyDataset* Dataset = nullptr;
+	// Directional light whose colour and sun disc follow the model's sun transmittance
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "ShaderControl")
+	ADirectionalLight* SunLight = nullptr;
+	// Stays white until SunLight is set, the transmittance block is loaded on first use
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "ShaderControl")
+	FLinearColor SunTransmittanceColor = FLinearColor::White;
+	// Decode the coefficients for QuerySkyRadianceRGB/Spectra on the thread pool after every load, so that queries from
+	// any thread find the evaluator without the game thread re-reading the slices; costs a second read and the doubles
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "ShaderControl")
+	bool bPrepareCpuEvaluator = false;
+	// Drive ShaderControlData.Altitude from the player camera height, streaming altitude slices as needed
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "ShaderControl")
+	bool bFollowCameraAltitude = false;
+	// Metres added to the camera height, e.g. the terrain height of the level origin
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "ShaderControl")
+	float CameraAltitudeOffset = 0.0f;
+	// Minimum camera height change (metres) that regenerates the sky
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "ShaderControl", meta = (ClampMin = "0.0"))
+	float AltitudeUpdateThreshold = 10.0f;
+	// Height of the generated panorama, 0 for half of ShaderControlData.Resolution (the width)
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "ShaderControl", meta = (ClampMin = "0", ClampMax = "8192"))
+	int32 OutputHeight = 0;
+	// Output size while ShaderControlData.bSkyViewLUT is set, in place of Resolution and OutputHeight
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "ShaderControl")
+	FIntPoint SkyViewLUTSize = FIntPoint(192, 108);
+	// While the controls keep changing the sky is evaluated at a reduced resolution, and refined once they settle
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "ShaderControl")
+	bool bPreviewWhileChanging = true;
+	// Preview resolution is the full resolution divided by this
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "ShaderControl", meta = (ClampMin = "1", ClampMax = "16"))
+	int32 PreviewDivisor = 4;
+	// Seconds without a change after which the full resolution sky is generated
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "ShaderControl", meta = (ClampMin = "0.0"))
+	float PreviewSettleTime = 0.2f;
+	// While only the sun keeps moving, each update re-evaluates one pixel in TemporalInterval (2 is a checkerboard)
+	// and reprojects the others from the previous sky; 1 evaluates every pixel
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "ShaderControl", meta = (ClampMin = "1", ClampMax = "8"))
+	int32 TemporalInterval = 1;
+	// Degrees around the sun inside which reprojected pixels are clamped to their freshly evaluated neighbours
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "ShaderControl", meta = (ClampMin = "0.0", ClampMax = "180.0"))
+	float HistoryClampAngle = 10.0f;
+	// Full resolution skies are baked in tiles over several frames within r.Wil21.Progressive.BudgetMs of GPU time,
+	// the output keeps the previous sky until the new one is complete
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "ShaderControl")
+	bool bProgressiveRegeneration = false;
+	// Reduce the generated sky to luminance statistics for auto-exposure, read back without stalling the render thread
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Luminance")
+	bool bComputeLuminance = false;
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Luminance")
+	float SkyMeanLuminance = 0.0f;
+	// exp2 of the mean log2 luminance, the usual auto-exposure key
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Luminance")
+	float SkyLogAverageLuminance = 0.0f;
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Luminance")
+	float SkyMaxLuminance = 0.0f;
+	// Pixel counts over log2 luminance bins from -8 to 24
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Luminance")
+	TArray<int32> SkyLuminanceHistogram;
+	// Copy every full resolution sky back to the CPU and pass it to OnSkyReadBack a few frames later, without stalling
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Readback")
+	bool bReadBackSky = false;
+	// Readbacks in flight at once; a sky generated while all of them wait for the GPU is not read back
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Readback", meta = (ClampMin = "1", ClampMax = "8"))
+	int32 ReadbackRingSize = 3;
+	// Game thread, in the order the skies were generated
+	UPROPERTY(BlueprintAssignable, Category = "Readback")
+	FOnWil21SkyReadBackDelegate OnSkyReadBack;
 	
 protected:  
 #if WITH_EDITOR  
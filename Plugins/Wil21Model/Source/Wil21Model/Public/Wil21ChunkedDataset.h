@@ -0,0 +1,64 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "DatProcessor.h"
+
+/**
+ * Compressed container for a .dat dataset (.w21c). Every visibility/albedo/altitude slice of the radiance block and both
+ * transmittance arrays are compressed on their own and listed in a chunk index after the headers, so a load reads only the
+ * chunks it selects and decompresses and decodes them in parallel, straight into the output arrays. Polarisation is dropped.
+ */
+struct FWil21ChunkedDataset
+{
+	struct FChunk
+	{
+		// Relative to the end of the chunk index
+		int64 Offset = 0;
+		// Equal to UncompressedBytes when the chunk is stored as is
+		int64 CompressedBytes = 0;
+		int64 UncompressedBytes = 0;
+
+		friend FArchive& operator<<(FArchive& Ar, FChunk& Chunk)
+		{
+			return Ar << Chunk.Offset << Chunk.CompressedBytes << Chunk.UncompressedBytes;
+		}
+	};
+
+	FString Path;
+	FName CompressionFormat;
+	// Radiance metadata, DataRad stays empty
+	FRadianceData Header;
+	// Transmittance metadata without the data arrays, RankTrans is 0 when the dataset has no transmittance block
+	FTransmittanceData TransmittanceHeader;
+	// [Visibility][Albedo][Altitude], the order of the slices in the .dat file
+	TArray<FChunk> RadianceChunks;
+	FChunk TransmittanceUChunk;
+	FChunk TransmittanceVChunk;
+	// File offset of the first chunk
+	int64 ChunkDataOffset = 0;
+
+	bool HasTransmittance() const { return TransmittanceHeader.RankTrans > 0; }
+
+	static bool IsChunkedDataset(const FString& Path);
+
+	/** Compresses the .dat file at DatPath into a container at OutPath, CompressionFormat being any FCompression format. */
+	static bool Write(const FString& DatPath, const FString& OutPath, FName CompressionFormat);
+
+	/** Reads the headers and the chunk index, chunks are only read by ReadRadiance and ReadTransmittance. */
+	static bool Open(const FString& Path, FWil21ChunkedDataset& OutDataset);
+
+	/** Same selection and result as UWil21BlueprintLibrary::ReadRadianceFile. */
+	bool ReadRadiance(double SingleVisibility, double SingleAltitude, FRadianceData& Result, TArray<uint32>* OutRawDataRad = nullptr, bool bDecodeCoefficients = true) const;
+	bool ReadTransmittance(int Channels, FTransmittanceData& Result) const;
+
+private:
+	int32 GetChunkIndex(int32 Visibility, int32 Albedo, int32 Altitude) const
+	{
+		return (Visibility * Header.AlbedosRad.Num() + Albedo) * Header.AltitudesInFile.Num() + Altitude;
+	}
+
+	// Reads a chunk with its own file handle, so any number of them can be in flight
+	bool ReadChunk(const FChunk& Chunk, void* Dest, int64 DestBytes) const;
+
+	friend FArchive& operator<<(FArchive& Ar, FWil21ChunkedDataset& Dataset);
+};
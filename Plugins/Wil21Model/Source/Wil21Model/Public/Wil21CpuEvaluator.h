@@ -0,0 +1,41 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Misc/ScopeLock.h"
+#include "DatProcessor.h"
+
+/**
+ * CPU evaluation of the radiance model for arbitrary view directions, four directions at a time in SIMD lanes.
+ * Immutable after construction, so one instance can be shared between any number of worker threads.
+ * Directions use the panorama frame: +Z is the zenith and azimuth runs from +X towards +Y.
+ */
+class WIL21MODEL_API FWil21CpuEvaluator
+{
+public:
+	/** Takes over the decoded coefficients (DataRad) of the loaded slices. */
+	explicit FWil21CpuEvaluator(FRadianceData InRadiance);
+	~FWil21CpuEvaluator();
+
+	bool IsValid() const { return Radiance.DataRad.Num() > 0; }
+	int32 GetChannelCount() const { return Radiance.Channels; }
+	const FRadianceData& GetRadianceData() const { return Radiance; }
+
+	/** Radiance of every channel per direction, direction major: OutSpectra must hold Directions.Num() * GetChannelCount() values. */
+	void EvaluateSpectra(TArrayView<const FVector> Directions, const FShaderControlData& Control, TArrayView<double> OutSpectra) const;
+
+	/** Linear sRGB radiance per direction, converted with the same channel weights as the sun colour. */
+	void EvaluateRGB(TArrayView<const FVector> Directions, const FShaderControlData& Control, TArrayView<FLinearColor> OutColors) const;
+
+private:
+	FRadianceData Radiance;
+	TArray<FVector3d> ChannelToRGB;
+};
+
+/** The evaluator of the currently loaded slices, published by whichever thread built it and read from any thread. */
+struct FWil21CpuEvaluatorSlot
+{
+	FCriticalSection Lock;
+	TSharedPtr<const FWil21CpuEvaluator, ESPMode::ThreadSafe> Evaluator;
+	// Bumped by every load, so a build started for older slices is dropped
+	uint32 Generation = 0;
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+class IFileHandle;
+
+/**
+ * Table of contents of a .dat dataset: the byte offset of every block and of every visibility/altitude slice,
+ * so any part of the file can be opened with a single seek. Built once by parsing the block headers and cached
+ * in memory and as a .toc sidecar; both are rebuilt whenever the dataset size or fingerprint stop matching.
+ * The fingerprint only hashes the block headers and the last 64 KB, so an edit confined to the coefficients in
+ * between, which leaves the layout as it was, keeps the index.
+ */
+struct FWil21DatasetIndex
+{
+	int64 FileSize = 0;
+	uint64 Fingerprint = 0;
+
+	// Radiance block
+	int64 RadianceHeaderOffset = 0;
+	int64 RadianceDataOffset = 0;
+	int64 RadianceConfigBytes = 0;
+	int32 VisibilityCount = 0;
+	int32 AlbedoCount = 0;
+	int32 AltitudeCount = 0;
+	// Channels * elevations, the configs of one altitude slice
+	int32 ConfigsPerAltitude = 0;
+	TArray<int64> VisibilitySliceOffsets;
+	// [Visibility][Albedo][Altitude]
+	TArray<int64> AltitudeSliceOffsets;
+
+	// Transmittance block, INDEX_NONE when the file ends after the radiance block
+	int64 TransmittanceHeaderOffset = INDEX_NONE;
+	int64 TransmittanceUOffset = INDEX_NONE;
+	int64 TransmittanceVOffset = INDEX_NONE;
+	int64 TransmittanceEndOffset = INDEX_NONE;
+
+	// Polarisation block, only present in the full dataset
+	int64 PolarisationOffset = INDEX_NONE;
+
+	bool HasTransmittance() const { return TransmittanceHeaderOffset != INDEX_NONE; }
+	bool HasPolarisation() const { return PolarisationOffset != INDEX_NONE; }
+
+	int64 GetVisibilitySliceOffset(int32 Visibility) const { return VisibilitySliceOffsets[Visibility]; }
+	// Slices of one visibility and albedo are contiguous, so a run of altitudes is read from the first slice offset
+	int64 GetAltitudeSliceOffset(int32 Visibility, int32 Albedo, int32 Altitude) const { return AltitudeSliceOffsets[(Visibility * AlbedoCount + Albedo) * AltitudeCount + Altitude]; }
+	int64 GetAltitudeSliceBytes() const { return RadianceConfigBytes * ConfigsPerAltitude; }
+
+	/** Parses the block headers of an open dataset. */
+	static bool Build(IFileHandle* Handle, FWil21DatasetIndex& OutIndex);
+
+	/** Returns the cached index of a dataset, reading the sidecar or rebuilding (and rewriting) it when stale. */
+	static bool LoadOrBuild(const FString& DatasetPath, IFileHandle* Handle, FWil21DatasetIndex& OutIndex);
+
+	friend FArchive& operator<<(FArchive& Ar, FWil21DatasetIndex& Index);
+
+private:
+	static uint64 ComputeFingerprint(IFileHandle* Handle, const FWil21DatasetIndex& Index);
+};
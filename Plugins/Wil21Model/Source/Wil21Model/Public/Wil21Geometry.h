@@ -0,0 +1,80 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "DatProcessor.h"
+
+// Per-sky stage of the model, shared by the shaders and FWil21CpuEvaluator. Everything that only depends on the controls, the
+// geometry and the interpolation of the controls, is computed once per sky; the view angles of an output layout come from a
+// table built once per size.
+
+/**
+ * acos by the polynomial of Abramowitz & Stegun 4.4.45, mirrored by Wil21FastAcos in Wil21Geometry.ush.
+ * At most 6.8e-5 rad (0.004 degrees) from acos over [-1, 1], in float as well as in double. Inputs outside are clamped.
+ */
+template <typename T>
+FORCEINLINE T Wil21FastAcos(T X)
+{
+	const T AbsX = FMath::Min(FMath::Abs(X), T(1));
+	const T Result = FMath::Sqrt(T(1) - AbsX) * (T(1.5707288) + AbsX * (T(-0.2121144) + AbsX * (T(0.0742610) + AbsX * T(-0.0187293))));
+	return X < T(0) ? T(UE_DOUBLE_PI) - Result : Result;
+}
+
+/** The per-sky part of ComputeParameters in Wil21.usf. */
+struct FWil21SkyGeometry
+{
+	FVector SunDirection;
+	// A quarter turn above the sun in its vertical plane, only queried with the sun below the horizon
+	FVector ShadowDirection;
+	// Added to the z of a view direction to correct it for the observer altitude
+	double ViewCorrection = 0.0;
+	// Radians
+	double SolarElevation = 0.0;
+	// Rotates the sun-relative directions of a sky-view LUT table to the sun azimuth
+	FVector2D SunAzimuthCosSin;
+	// Observer altitude as the model is queried, raised by a safety offset above the ground
+	double ViewHeight = 0.0;
+
+	explicit FWil21SkyGeometry(const FShaderControlData& Control);
+};
+
+/** Observer altitude as the model is queried, raised by a safety offset above the ground. */
+double GetWil21ViewHeight(double Altitude);
+
+/** Segment of Value clamped to Breaks and the factor within it, as GetInterpolationParameter in Wil21.usf. */
+struct FWil21Interpolation
+{
+	// The last break is the end of the last segment, so Index + 1 stays in range
+	int32 Index = 0;
+	double Factor = 0.0;
+};
+WIL21MODEL_API FWil21Interpolation GetWil21Interpolation(TConstArrayView<double> Breaks, double Value);
+
+/**
+ * Brackets of the visibility, albedo, altitude and elevation of a sky in that order, and the corners of the multilinear blend
+ * they contribute. A corner is a 4 bit index, bit 3 for visibility down to bit 0 for elevation, set for the upper neighbour.
+ * An axis with a factor below 1e-6 keeps its lower neighbour, one within 1e-6 of 1 its upper one, only the others are active.
+ */
+struct FWil21ControlCorners
+{
+	FWil21Interpolation Axes[4];
+	uint32 ActiveMask = 0;
+	uint32 UpperMask = 0;
+
+	FWil21ControlCorners(TConstArrayView<double> Visibilities, TConstArrayView<double> Albedos, TConstArrayView<double> Altitudes,
+		TConstArrayView<double> Elevations, const FShaderControlData& Control);
+};
+
+/**
+ * View angles of the output layout, separable in both: Size.X column entries (cos, sin of the azimuth, 0, 0) followed by
+ * Size.Y row entries (cos, sin of the elevation, zenith angle, 0). Columns of the panorama start at +x, those of the sky-view
+ * LUT of Wil21SkyViewLUT.ush are relative to the sun.
+ */
+WIL21MODEL_API void BuildWil21ViewTable(FIntPoint Size, bool bSkyViewLUT, TArray<FVector4f>& OutTable);
+
+/** View direction (xyz) and zenith angle (w) of Pixel as GetViewDirection in Wil21Geometry.ush, LUT directions for a sun at azimuth 0. */
+FORCEINLINE FVector4f GetWil21ViewDirection(TConstArrayView<FVector4f> Table, FIntPoint Size, FIntPoint Pixel)
+{
+	const FVector4f& Column = Table[Pixel.X];
+	const FVector4f& Row = Table[Size.X + Pixel.Y];
+	return FVector4f(Row.X * Column.X, Row.X * Column.Y, Row.Y, Row.Z);
+}
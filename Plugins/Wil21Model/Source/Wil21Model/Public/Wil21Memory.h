@@ -0,0 +1,17 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/LowLevelMemTracker.h"
+#include "Stats/Stats.h"
+
+// Allocations of the plugin are tagged Wil21Model in LLM (-llm, stat LLM); the coefficient copies are also listed in stat memory
+LLM_DECLARE_TAG_API(Wil21Model, WIL21MODEL_API);
+
+// Decoded doubles held by CPU evaluators
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Wil21 CPU coefficients"), STAT_Wil21CpuCoefficients, STATGROUP_Memory, WIL21MODEL_API);
+// Raw configurations waiting for their upload
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Wil21 upload staging"), STAT_Wil21UploadStaging, STATGROUP_Memory, WIL21MODEL_API);
+// Resident coefficient buffers
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Wil21 GPU coefficients"), STAT_Wil21GpuCoefficients, STATGROUP_Memory, WIL21MODEL_API);
+// Generated skies kept by FWil21SkyCache
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Wil21 sky cache"), STAT_Wil21SkyCache, STATGROUP_Memory, WIL21MODEL_API);
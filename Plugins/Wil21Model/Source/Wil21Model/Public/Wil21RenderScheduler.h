@@ -0,0 +1,69 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Wil21Rendering.h"
+#include "Wil21SkyCache.h"
+
+// Everything one sky regeneration needs, captured on the game thread
+struct FWil21RenderRequest
+{
+	FShaderPackedData ShaderPackedData;
+	FShaderControlData ShaderControlData;
+	TSharedPtr<FWil21CoefficientBuffer, ESPMode::ThreadSafe> CoefficientBuffer;
+	FTexture2DRHIRef RenderTargetRHI;
+	TSharedPtr<FWil21LuminanceReadback, ESPMode::ThreadSafe> LuminanceReadback;
+	// Copies the finished sky back to the CPU, see FWil21SkyReadback
+	TSharedPtr<FWil21SkyReadback, ESPMode::ThreadSafe> SkyReadback;
+	// Evaluated at the render target size / PreviewDivisor and upsampled to it
+	bool bPreview = false;
+	int32 PreviewDivisor = 4;
+	// Kept across requests of one output; Interval and ClampAngle are applied to it on the render thread
+	TSharedPtr<FWil21TemporalHistory, ESPMode::ThreadSafe> TemporalHistory;
+	// 1 evaluates every pixel, see FWil21TemporalHistory
+	int32 TemporalInterval = 1;
+	float HistoryClampAngle = 10.0f;
+	// Rendered tile by tile over several frames into a back buffer that replaces the output once complete
+	bool bProgressive = false;
+};
+
+/**
+ * Coalesces sky regenerations: at most one request waits for the render thread, a newer one replaces it.
+ * A burst of changes therefore costs one dispatch per rendered frame instead of one per change.
+ * Progressive requests are baked in tiles within r.Wil21.Progressive.BudgetMs of GPU time per frame, a newer request cancels the bake.
+ */
+class WIL21MODEL_API FWil21RenderScheduler : public TSharedFromThis<FWil21RenderScheduler, ESPMode::ThreadSafe>
+{
+public:
+	/** Game thread. Replaces the pending request, if any, and makes sure a render command will pick it up. */
+	void Request(FWil21RenderRequest&& InRequest);
+	/** Game thread, once per frame. Renders the next tiles of a progressive bake. */
+	void Tick();
+
+private:
+	struct FWil21ProgressiveBake
+	{
+		FWil21RenderRequest Request;
+		FWil21SkyCacheKey CacheKey;
+		TRefCountPtr<IPooledRenderTarget> BackBuffer;
+		int32 TileSize = 256;
+		int32 TotalTiles = 0;
+		int32 NextTile = 0;
+	};
+
+	void QueueRenderCommand();
+	void RenderPending(FRHICommandListImmediate& RHICmdList);
+	void RenderRequest(FRHICommandListImmediate& RHICmdList, FWil21RenderRequest&& Request);
+	void ContinueBake(FRHICommandListImmediate& RHICmdList);
+
+	FCriticalSection Lock;
+	TOptional<FWil21RenderRequest> Pending;
+	bool bCommandQueued = false;
+	bool bBakeInProgress = false;
+	// Render thread only
+	FWil21SkyCache SkyCache;
+	TOptional<FWil21ProgressiveBake> Bake;
+	// Timestamps around the last timed batch of tiles, TimedTiles is 0 once they were read
+	FRenderQueryRHIRef TileTimerQueries[2];
+	int32 TimedTiles = 0;
+	float MillisecondsPerTile = -1.0f;
+};
@@ -8,6 +8,7 @@
 #include "Kismet/BlueprintFunctionLibrary.h"
 #include "RHIStaticStates.h"
 #include "RenderResource.h"
+#include "RHIGPUReadback.h"
 #include "Engine/TextureRenderTarget2D.h"
 //
 // #include "PipelineStateCache.h"
@@ -21,6 +22,8 @@
 
 
 #include  "DatProcessor.h"
+#include "Wil21Memory.h"
+#include "Wil21Geometry.h"
 #include "Wil21Rendering.generated.h"
 // 
 
@@ -28,11 +31,107 @@
 class FRHICommandListImmediate;
 struct IPooledRenderTarget;
 
-#define SPECTRUM_SIZE 11
+// Upper bound of the channels of a dataset, matches Wil21.ush
+#define WIL21_MAX_CHANNELS 16
+// Breakpoints per angle the specialised layouts keep in constants
+#define WIL21_MAX_CONSTANT_BREAKS 128
 
-struct FSpectrum  
-{  
-	double Values[SPECTRUM_SIZE];  
+// Persistent coefficient buffer, created on the game thread and filled/read by render commands only
+struct FWil21CoefficientBuffer
+{
+	~FWil21CoefficientBuffer()
+	{
+		DEC_MEMORY_STAT_BY(STAT_Wil21GpuCoefficients, ResidentBytes);
+	}
+
+	TRefCountPtr<FRDGPooledBuffer> DataRad;
+	// Size of DataRad as counted in STAT_Wil21GpuCoefficients
+	int64 ResidentBytes = 0;
+};
+
+#define WIL21_LUMINANCE_GROUP_SIZE 16
+#define WIL21_HISTOGRAM_BINS 64
+// Mean, log-average, max and pixel count precede the histogram in the stats buffer
+#define WIL21_LUMINANCE_STATS 4
+
+struct FWil21LuminanceStats
+{
+	float Mean = 0.0f;
+	float LogAverage = 0.0f;
+	float Max = 0.0f;
+	// Pixel counts per log2 luminance bin between HistogramMinLog2 and HistogramMaxLog2
+	TArray<uint32> Histogram;
+	bool bValid = false;
+};
+
+// Luminance of the last generated sky. The readback is only touched by render commands, the game thread reads Latest.
+struct FWil21LuminanceReadback
+{
+	float HistogramMinLog2 = -8.0f;
+	float HistogramMaxLog2 = 24.0f;
+	TUniquePtr<FRHIGPUBufferReadback> Readback;
+	bool bPending = false;
+
+	FWil21LuminanceStats GetLatest() const
+	{
+		FScopeLock ScopeLock(&Lock);
+		return Latest;
+	}
+
+	mutable FCriticalSection Lock;
+	FWil21LuminanceStats Latest;
+};
+
+// One generated sky copied back to the CPU, row major linear colour
+struct FWil21SkyPixels
+{
+	FShaderControlData Control;
+	FIntPoint Size = FIntPoint::ZeroValue;
+	TArray<FLinearColor> Pixels;
+};
+
+// Generated skies read back without stalling. Render commands enqueue copies into a ring of RingSize readbacks and poll the
+// oldest ones, a sky generated while every slot is in flight is dropped. The game thread takes finished skies with TakeCompleted.
+struct FWil21SkyReadback
+{
+	explicit FWil21SkyReadback(int32 InRingSize) : RingSize(FMath::Max(InRingSize, 1)) {}
+
+	struct FSlot
+	{
+		TUniquePtr<FRHIGPUTextureReadback> Readback;
+		FShaderControlData Control;
+		FIntPoint Size = FIntPoint::ZeroValue;
+		EPixelFormat Format = PF_Unknown;
+	};
+	const int32 RingSize;
+	// Render thread only: PendingCount slots starting at FirstPending wait for the GPU, oldest first
+	TArray<FSlot> Slots;
+	int32 FirstPending = 0;
+	int32 PendingCount = 0;
+	int32 DroppedSkies = 0;
+
+	TArray<FWil21SkyPixels> TakeCompleted()
+	{
+		FScopeLock ScopeLock(&Lock);
+		return MoveTemp(Completed);
+	}
+
+	mutable FCriticalSection Lock;
+	TArray<FWil21SkyPixels> Completed;
+};
+
+// Previous sky of a temporally amortised output, only touched by render commands
+struct FWil21TemporalHistory
+{
+	// 1 evaluates every pixel, 2 is a checkerboard, N re-evaluates one pixel in N per frame
+	int32 Interval = 1;
+	// Degrees around the sun inside which reprojected history is clamped to the fresh neighbours
+	float ClampAngle = 10.0f;
+
+	TRefCountPtr<IPooledRenderTarget> Texture;
+	TRefCountPtr<FRDGPooledBuffer> DataRad;
+	FShaderControlData Control;
+	uint32 FrameIndex = 0;
 };
 
 
@@ -49,90 +148,386 @@ public:
 };
 
 
+// Model coefficients and lookup tables shared by every Wil21 compute entry point
+BEGIN_SHADER_PARAMETER_STRUCT(FWil21ModelParameters, )
+	// RadianceMetadata  
+	 SHADER_PARAMETER(int32, Rank)  
+	 SHADER_PARAMETER(int32, SunOffset)  
+	 SHADER_PARAMETER(int32, SunStride)  
+	 SHADER_PARAMETER(int32, ZenithOffset)  
+	 SHADER_PARAMETER(int32, ZenithStride)  
+	 SHADER_PARAMETER(int32, EmphOffset)  
+	 SHADER_PARAMETER(int32, TotalCoefsSingleConfig)  
+	 SHADER_PARAMETER(int32, TotalCoefsAllConfigs)  
+	 SHADER_PARAMETER(int32, SunBreaksSize)  
+	 SHADER_PARAMETER(int32, ZenithBreaksSize)  
+	 SHADER_PARAMETER(int32, EmphBreaksSize)  
+
+	 // RadianceData  
+	 SHADER_PARAMETER(int32, VisibilitiesRadSize)  
+	 SHADER_PARAMETER(int32, AlbedosRadSize)  
+	 SHADER_PARAMETER(int32, AltitudesRadSize)  
+	 SHADER_PARAMETER(int32, ElevationsRadSize)
+	 SHADER_PARAMETER(int32, DataRadSize)  
+
+	 // Channel layout, see Wil21.ush
+	 SHADER_PARAMETER(int32, ChannelCount)
+	 SHADER_PARAMETER(int32, ActiveChannelCount)
+	 SHADER_PARAMETER_ARRAY(FVector4f, ChannelWeights, [WIL21_MAX_CHANNELS])
+	 // Angle breakpoints of the specialised layouts, see FWil21RankDim
+	 SHADER_PARAMETER_ARRAY(FUintVector4, ConstantBreaks, [3 * WIL21_MAX_CONSTANT_BREAKS / 2])
+
+	 // Meta data buffers  
+	 SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<DoublePacked>, SunBreaks)  
+	 SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<DoublePacked>, ZenithBreaks)  
+	 SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<DoublePacked>, EmphBreaks)  
+
+	 // Radiance data buffers  
+	 // Elevation-interleaved doubles or double-float pairs, see CreateWil21CoefficientBuffer
+	 SHADER_PARAMETER_RDG_BUFFER_SRV(ByteAddressBuffer, DataRad)
+END_SHADER_PARAMETER_STRUCT()
+
+// Thread group shapes of the sky evaluation, picked per platform by GetWil21ThreadGroupShape
+enum class EWil21ThreadGroupShape : uint8
+{
+	Group8x8,
+	Group16x16,
+	Group32x8,
+	MAX
+};
+
+// Groupshared budget for one staged configuration (uint pairs per double), 24 KB
+#define WIL21_STAGED_CONFIG_UINTS 6144
+
+class FWil21ThreadGroupShapeDim : SHADER_PERMUTATION_ENUM_CLASS("WIL21_THREADGROUP_SHAPE", EWil21ThreadGroupShape);
+class FWil21StageCoefficientsDim : SHADER_PERMUTATION_BOOL("WIL21_STAGE_COEFFICIENTS");
+// Unrolled bound of the channel loop: 10 covers the shipped 11-channel datasets, whose 340 nm channel has no colour weight
+class FWil21ActiveChannelsDim : SHADER_PERMUTATION_SPARSE_INT("WIL21_ACTIVE_CHANNELS", 10, WIL21_MAX_CHANNELS);
+// Rank baked into the reconstruction loops, with the angle breakpoints in constants; 0 is the generic layout for any other dataset
+class FWil21RankDim : SHADER_PERMUTATION_SPARSE_INT("WIL21_RANK", 0, 6, 8, 12);
+// Double-float coefficients and reconstruction for GPUs with weak or no fp64, must match how DataRad was decoded
+class FWil21Df64Dim : SHADER_PERMUTATION_BOOL("WIL21_DF64");
+using FWil21SkyPermutationDomain = TShaderPermutationDomain<FWil21ThreadGroupShapeDim, FWil21StageCoefficientsDim, FWil21ActiveChannelsDim, FWil21RankDim, FWil21Df64Dim>;
+
+FIntPoint GetWil21ThreadGroupSize(EWil21ThreadGroupShape Shape);
+// r.Wil21.ThreadGroupShape, or a default for the GPU in use when it is -1
+EWil21ThreadGroupShape GetWil21ThreadGroupShape();
+// Staging is used when r.Wil21.StageCoefficients is on and one configuration fits the groupshared budget,
+// the channel loop is specialised on the number of channels with a colour weight,
+// and the layout on the rank when r.Wil21.SpecialiseLayout is on, the breakpoints fit the constants and the 10 channel loop is staged
+FWil21SkyPermutationDomain GetWil21SkyPermutation(const FShaderPackedData& ShaderPackedData);
+// Sets THREADGROUP_SIZE_X/Y and the staging defines of a sky evaluation permutation
+void ModifyWil21SkyCompilationEnvironment(const FWil21SkyPermutationDomain& PermutationVector, FShaderCompilerEnvironment& OutEnvironment);
+// fp64 permutations are compiled for SM6 only. SM5 gets every double-float permutation, ES3_1 the unstaged 8x8 ones.
+// The rank layouts are only compiled staged with the 10 channel loop, 42 of the 96 permutations on SM6.
+bool ShouldCompileWil21SkyPermutation(const FGlobalShaderPermutationParameters& Parameters, const FWil21SkyPermutationDomain& PermutationVector);
+// Always below SM6, where only double-float is compiled; otherwise r.Wil21.Df64, or whether the GPU lacks fast fp64 when it is -1
+bool UseWil21Df64();
+// Fewest rank terms within the error of r.Wil21.RankQuality, by the analysis made when the dataset was packed
+int32 GetWil21KeptRank(const FShaderPackedData& ShaderPackedData);
+
+// FWil21SkyGeometry in float, laid out as Wil21SkyGeometry in Wil21Geometry.ush
+struct FWil21GpuSkyGeometry
+{
+	FVector3f SunDirection;
+	float ViewCorrection;
+	FVector3f ShadowDirection;
+	float SolarElevation;
+	FVector2f SunAzimuthCosSin;
+	float ViewHeight;
+	float Padding = 0.0f;
+
+	explicit FWil21GpuSkyGeometry(const FWil21SkyGeometry& Geometry)
+		: SunDirection(Geometry.SunDirection)
+		, ViewCorrection(float(Geometry.ViewCorrection))
+		, ShadowDirection(Geometry.ShadowDirection)
+		, SolarElevation(float(Geometry.SolarElevation))
+		, SunAzimuthCosSin(Geometry.SunAzimuthCosSin)
+		, ViewHeight(float(Geometry.ViewHeight))
+	{
+	}
+};
+static_assert(sizeof(FWil21GpuSkyGeometry) == 48, "FWil21GpuSkyGeometry must match Wil21SkyGeometry");
+
+// The per-sky geometry of a single sky dispatch, the same fields as FWil21GpuSkyGeometry
+BEGIN_SHADER_PARAMETER_STRUCT(FWil21SkyGeometryParameters, )
+	SHADER_PARAMETER(FVector3f, SunDirection)
+	SHADER_PARAMETER(float, ViewCorrection)
+	SHADER_PARAMETER(FVector3f, ShadowDirection)
+	SHADER_PARAMETER(float, SolarElevation)
+	SHADER_PARAMETER(FVector2f, SunAzimuthCosSin)
+	SHADER_PARAMETER(float, ViewHeight)
+END_SHADER_PARAMETER_STRUCT()
+
+// FWil21ControlCorners as the shaders read it, laid out as Wil21SkyControls in Wil21.usf. The factors keep all their bits, as
+// uint pairs like DoublePacked: visibility and albedo in FactorBits0, altitude and elevation in FactorBits1.
+struct FWil21GpuSkyControls
+{
+	FIntVector4 Index;
+	FUintVector4 FactorBits0;
+	FUintVector4 FactorBits1;
+	uint32 ActiveMask;
+	uint32 UpperMask;
+	uint32 Padding[2] = { 0, 0 };
+
+	explicit FWil21GpuSkyControls(const FWil21ControlCorners& Corners);
+};
+static_assert(sizeof(FWil21GpuSkyControls) == 64, "FWil21GpuSkyControls must match Wil21SkyControls");
+
+// The controls of a single sky dispatch, the same fields as FWil21GpuSkyControls
+BEGIN_SHADER_PARAMETER_STRUCT(FWil21SkyControlParameters, )
+	SHADER_PARAMETER(FIntVector4, ControlIndex)
+	SHADER_PARAMETER(FUintVector4, ControlFactorBits0)
+	SHADER_PARAMETER(FUintVector4, ControlFactorBits1)
+	SHADER_PARAMETER(uint32, ControlActiveMask)
+	SHADER_PARAMETER(uint32, ControlUpperMask)
+END_SHADER_PARAMETER_STRUCT()
+
 class FWil21RDGComputeShader : public FGlobalShader
 {
 public:
 	DECLARE_GLOBAL_SHADER(FWil21RDGComputeShader);
 	SHADER_USE_PARAMETER_STRUCT(FWil21RDGComputeShader, FGlobalShader);
 
+	using FPermutationDomain = FWil21SkyPermutationDomain;
+
 	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
 		// Shader control data
-		SHADER_PARAMETER(int32, Resolution)
-		SHADER_PARAMETER(float, SolarElevation)
-		SHADER_PARAMETER(float, SolarAzimuth)
-		SHADER_PARAMETER(float, Albedo)
-		SHADER_PARAMETER(float, Visibility)
-		SHADER_PARAMETER(float, Altitude)
+		SHADER_PARAMETER(FIntPoint, OutputSize)
+		SHADER_PARAMETER_STRUCT_INCLUDE(FWil21SkyControlParameters, Controls)
+		SHADER_PARAMETER_STRUCT_INCLUDE(FWil21SkyGeometryParameters, Geometry)
+		// 1 to write the sky-view LUT layout instead of the panorama
+		SHADER_PARAMETER(uint32, SkyViewLUT)
+		SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<float4>, ViewTable)
 	
-		// RadianceMetadata  
-		 SHADER_PARAMETER(int32, Rank)  
-		 SHADER_PARAMETER(int32, SunOffset)  
-		 SHADER_PARAMETER(int32, SunStride)  
-		 SHADER_PARAMETER(int32, ZenithOffset)  
-		 SHADER_PARAMETER(int32, ZenithStride)  
-		 SHADER_PARAMETER(int32, EmphOffset)  
-		 SHADER_PARAMETER(int32, TotalCoefsSingleConfig)  
-		 SHADER_PARAMETER(int32, TotalCoefsAllConfigs)  
-		 SHADER_PARAMETER(int32, SunBreaksSize)  
-		 SHADER_PARAMETER(int32, ZenithBreaksSize)  
-		 SHADER_PARAMETER(int32, EmphBreaksSize)  
-
-		 // RadianceData  
-		 SHADER_PARAMETER(int32, VisibilitiesRadSize)  
-		 SHADER_PARAMETER(int32, AlbedosRadSize)  
-		 SHADER_PARAMETER(int32, AltitudesRadSize)  
-		 SHADER_PARAMETER(int32, ElevationsRadSize)
-		 SHADER_PARAMETER(int32, DataRadSize)  
-
-		 // Meta data buffers  
-		 SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<DoublePacked>, SunBreaks)  
-		 SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<DoublePacked>, ZenithBreaks)  
-		 SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<DoublePacked>, EmphBreaks)  
-
-		 // Radiance data buffers  
-		 SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<DoublePacked>, VisibilitiesRad)  
-		 SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<DoublePacked>, AlbedosRad)  
-		 SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<DoublePacked>, AltitudesRad)  
-		 SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<DoublePacked>, ElevationsRad)  
-		 SHADER_PARAMETER_RDG_BUFFER_SRV(Buffer<uint32>, DataRad)  
+		SHADER_PARAMETER_STRUCT_INCLUDE(FWil21ModelParameters, Model)
 
 		 // SHADER_PARAMETER_RDG_BUFFER_SRV(Buffer<uint32>, SpectralResponse) 
-		 // Output buffer  
-		 SHADER_PARAMETER_RDG_BUFFER_UAV(RWStructuredBuffer<FSpectrum>, OutputBuffer)
+		 // Output texture  
 	     SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture2D<float4>, OutTexture)
+		// One pixel in TemporalInterval per row is evaluated, 1 for all of them
+		SHADER_PARAMETER(uint32, TemporalInterval)
+		SHADER_PARAMETER(uint32, TemporalPhase)
+		SHADER_PARAMETER(FUintVector2, TileOffset)
+	END_SHADER_PARAMETER_STRUCT()
+
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return ShouldCompileWil21SkyPermutation(Parameters, FPermutationDomain(Parameters.PermutationId));
+	}
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		ModifyWil21SkyCompilationEnvironment(FPermutationDomain(Parameters.PermutationId), OutEnvironment);
+	}
+};
+
+// Per-slice controls of a batched dispatch, laid out as Wil21BatchControl in Wil21.usf
+struct FWil21BatchControl
+{
+	FWil21GpuSkyGeometry Geometry;
+	FWil21GpuSkyControls Controls;
+};
+static_assert(sizeof(FWil21BatchControl) == 112, "FWil21BatchControl must match Wil21BatchControl");
+
+// Evaluates one sky per FShaderControlData into the slices of a texture array, Z of the dispatch picks the slice
+class FWil21BatchRDGComputeShader : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FWil21BatchRDGComputeShader);
+	SHADER_USE_PARAMETER_STRUCT(FWil21BatchRDGComputeShader, FGlobalShader);
+
+	using FPermutationDomain = FWil21SkyPermutationDomain;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(FIntPoint, OutputSize)
+		SHADER_PARAMETER(uint32, SliceCount)
+		SHADER_PARAMETER(uint32, SkyViewLUT)
+		SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<float4>, ViewTable)
+		SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<Wil21BatchControl>, BatchControls)
+		SHADER_PARAMETER_STRUCT_INCLUDE(FWil21ModelParameters, Model)
+		SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture2DArray<float4>, OutTextureArray)
+	END_SHADER_PARAMETER_STRUCT()
+
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return ShouldCompileWil21SkyPermutation(Parameters, FPermutationDomain(Parameters.PermutationId));
+	}
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		ModifyWil21SkyCompilationEnvironment(FPermutationDomain(Parameters.PermutationId), OutEnvironment);
+	}
+};
+
+class FWil21UpsampleCS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FWil21UpsampleCS);
+	SHADER_USE_PARAMETER_STRUCT(FWil21UpsampleCS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D<float4>, InTexture)
+		SHADER_PARAMETER_SAMPLER(SamplerState, InSampler)
+		SHADER_PARAMETER(FUintVector2, OutputSize)
+		SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture2D<float4>, OutTexture)
+	END_SHADER_PARAMETER_STRUCT()
+
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+// Expands the raw fp16 configurations of a dataset into the double coefficients of DataRad, interleaving the elevations
+class FWil21DecodeCoefficientsCS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FWil21DecodeCoefficientsCS);
+	SHADER_USE_PARAMETER_STRUCT(FWil21DecodeCoefficientsCS, FGlobalShader);
+
+	using FPermutationDomain = TShaderPermutationDomain<FWil21Df64Dim>;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, CoefCount)
+		SHADER_PARAMETER(uint32, DispatchThreads)
+		SHADER_PARAMETER(uint32, ConfigBytes)
+		SHADER_PARAMETER(uint32, CoefsPerConfig)
+		SHADER_PARAMETER(uint32, Rank)
+		SHADER_PARAMETER(uint32, SourceRank)
+		SHADER_PARAMETER(uint32, SunBreaksSize)
+		SHADER_PARAMETER(uint32, ZenithBreaksSize)
+		SHADER_PARAMETER(uint32, ChannelCount)
+		SHADER_PARAMETER(uint32, ElevationCount)
+		SHADER_PARAMETER_RDG_BUFFER_SRV(ByteAddressBuffer, RawDataRad)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWByteAddressBuffer, OutDataRad)
 	END_SHADER_PARAMETER_STRUCT()
 
 	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
 	{
-		// return RHISupportsComputeShaders(Parameters.Platform);
-		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM6);; // 
+		// The fp64 decode needs SM6, the double-float one runs wherever the sky shaders do
+		const FPermutationDomain PermutationVector(Parameters.PermutationId);
+		return IsFeatureLevelSupported(Parameters.Platform, PermutationVector.Get<FWil21Df64Dim>() ? ERHIFeatureLevel::ES3_1 : ERHIFeatureLevel::SM6);
 	}
 };
 
-class FSpectrumToColorRDGCS : public FGlobalShader
+// Completes a temporally amortised frame from the shifted previous sky
+class FWil21TemporalResolveCS : public FGlobalShader
 {
 public:
-	DECLARE_GLOBAL_SHADER(FSpectrumToColorRDGCS);
-	SHADER_USE_PARAMETER_STRUCT(FSpectrumToColorRDGCS, FGlobalShader);
+	DECLARE_GLOBAL_SHADER(FWil21TemporalResolveCS);
+	SHADER_USE_PARAMETER_STRUCT(FWil21TemporalResolveCS, FGlobalShader);
 
 	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
-		// Input data buffer
-		SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<FSpectrum>, InputBuffer)
-		SHADER_PARAMETER_RDG_BUFFER_SRV(Buffer<uint32>, SpectralResponseBuffer) 
-		// Output texure
-	    SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture2D<float4>, OutTexture)
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D<float4>, InTexture)
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D<float4>, HistoryTexture)
+		SHADER_PARAMETER_SAMPLER(SamplerState, HistorySampler)
+		SHADER_PARAMETER(FUintVector2, OutputSize)
+		SHADER_PARAMETER(uint32, TemporalInterval)
+		SHADER_PARAMETER(uint32, TemporalPhase)
+		SHADER_PARAMETER(float, HistoryShiftU)
+		SHADER_PARAMETER(FVector3f, SunDirection)
+		SHADER_PARAMETER(float, HistoryClampCos)
+		// Panorama view table of OutputSize, shared with the sky pass
+		SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<float4>, ViewTable)
+		SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture2D<float4>, OutTexture)
 	END_SHADER_PARAMETER_STRUCT()
 
 	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
 	{
-		// return RHISupportsComputeShaders(Parameters.Platform);
-		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM6);; // 
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
 	}
 };
 
+class FWil21LuminanceReduceCS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FWil21LuminanceReduceCS);
+	SHADER_USE_PARAMETER_STRUCT(FWil21LuminanceReduceCS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D<float4>, InTexture)
+		SHADER_PARAMETER(FUintVector2, InputSize)
+		SHADER_PARAMETER(uint32, GroupCountX)
+		SHADER_PARAMETER(float, HistogramMinLog2)
+		SHADER_PARAMETER(float, HistogramLog2Range)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWStructuredBuffer<float4>, PartialResults)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<uint>, OutStats)
+	END_SHADER_PARAMETER_STRUCT()
+
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+	}
 
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment);
+};
 
-void RDGComputeWil21Buffer(FRHICommandListImmediate& RHIImmCmdList, const FShaderPackedData& ShaderPackedData, const FShaderControlData& ShaderControlData, int32 OutputSize, int32 TextureSize, TRefCountPtr<FRDGPooledBuffer> DataRadPooledBuffer, FTexture2DRHIRef RenderTargetRHI);
+class FWil21LuminanceFinalizeCS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FWil21LuminanceFinalizeCS);
+	SHADER_USE_PARAMETER_STRUCT(FWil21LuminanceFinalizeCS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, PartialCount)
+		SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<float4>, InPartialResults)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<uint>, OutStats)
+	END_SHADER_PARAMETER_STRUCT()
+
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+	}
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment);
+};
+
+// LuminanceReadback is optional, when set the generated sky is also reduced to luminance statistics.
+// SkyReadback is optional, when set a full resolution sky is also copied back to the CPU (previews are not).
+// A TextureSize smaller than the render target renders a preview that is upsampled to the target.
+// With a TemporalHistory whose Interval is above 1, a sky that only moved with the sun re-evaluates a subset of the pixels and reprojects the rest.
+// Returns the pooled texture that was copied into RenderTargetRHI.
+TRefCountPtr<IPooledRenderTarget> RDGComputeWil21Buffer(FRHICommandListImmediate& RHIImmCmdList, const FShaderPackedData& ShaderPackedData, const FShaderControlData& ShaderControlData, FIntPoint TextureSize, TRefCountPtr<FRDGPooledBuffer> DataRadPooledBuffer, FTexture2DRHIRef RenderTargetRHI, FWil21LuminanceReadback* LuminanceReadback = nullptr, FWil21TemporalHistory* TemporalHistory = nullptr, FWil21SkyReadback* SkyReadback = nullptr);
+// Renders tiles [FirstTile, FirstTile + TileCount) of a TileSize grid over TextureSize into BackBuffer, allocating it on the first call.
+// StartQuery/EndQuery, when set, are timestamped around the tiles.
+void RDGComputeWil21Tiles(FRHICommandListImmediate& RHIImmCmdList, const FShaderPackedData& ShaderPackedData, const FShaderControlData& ShaderControlData, FIntPoint TextureSize, EPixelFormat Format, TRefCountPtr<FRDGPooledBuffer> DataRadPooledBuffer, TRefCountPtr<IPooledRenderTarget>& BackBuffer, int32 TileSize, int32 FirstTile, int32 TileCount, FRHIRenderQuery* StartQuery = nullptr, FRHIRenderQuery* EndQuery = nullptr);
+// Presents a full resolution sky generated earlier (cached or baked progressively) as if RDGComputeWil21Buffer had just produced it
+void PresentWil21Sky(FRHICommandListImmediate& RHIImmCmdList, const FShaderControlData& ShaderControlData, TRefCountPtr<FRDGPooledBuffer> DataRadPooledBuffer, TRefCountPtr<IPooledRenderTarget> CachedSky, FTexture2DRHIRef RenderTargetRHI, FWil21LuminanceReadback* LuminanceReadback = nullptr, FWil21TemporalHistory* TemporalHistory = nullptr, FWil21SkyReadback* SkyReadback = nullptr);
+// Renders every entry of Controls in a single dispatch into the matching slice of TextureArrayRHI (one slice per control)
+void RDGComputeWil21BatchBuffer(FRHICommandListImmediate& RHIImmCmdList, const FShaderPackedData& ShaderPackedData, TConstArrayView<FShaderControlData> Controls, TRefCountPtr<FRDGPooledBuffer> DataRadPooledBuffer, FTextureRHIRef TextureArrayRHI);
+// Uploads RawDataRad as it is on disk and decodes it on the GPU into the coefficient buffer the sky shaders read.
+// The buffer interleaves the elevations (coefficient j of every elevation is contiguous), unlike the CPU side DataRad.
+TRefCountPtr<FRDGPooledBuffer> CreateWil21CoefficientBuffer(FRHICommandListImmediate& RHIImmCmdList, const FShaderPackedData& ShaderPackedData, const TArray<uint32>& RawDataRad);
+// The constant breakpoints are only filled for the specialised layouts of PermutationVector
+void SetupWil21ModelParameters(FRDGBuilder& GraphBuilder, const FShaderPackedData& ShaderPackedData, const FWil21SkyPermutationDomain& PermutationVector, TRefCountPtr<FRDGPooledBuffer> DataRadPooledBuffer, FWil21ModelParameters& OutParameters);
+void SetupWil21SkyGeometryParameters(const FShaderControlData& ShaderControlData, FWil21SkyGeometryParameters& OutParameters);
+// Brackets of the controls in the loaded slices, found once per sky instead of once per pixel
+FWil21ControlCorners GetWil21ControlCorners(const FShaderPackedData& ShaderPackedData, const FShaderControlData& ShaderControlData);
+void SetupWil21SkyControlParameters(const FShaderPackedData& ShaderPackedData, const FShaderControlData& ShaderControlData, FWil21SkyControlParameters& OutParameters);
+// View table (BuildWil21ViewTable) of an output layout, built on first use and kept for later dispatches of the same size and layout
+FRDGBufferSRVRef GetWil21ViewTable(FRDGBuilder& GraphBuilder, FIntPoint OutputSize, bool bSkyViewLUT);
+void AddWil21LuminancePasses(FRDGBuilder& GraphBuilder, FRDGTextureRef SkyTexture, FWil21LuminanceReadback& LuminanceReadback);
+// Copies a finished readback into LuminanceReadback.Latest without waiting for the GPU
+void PollWil21LuminanceReadback(FWil21LuminanceReadback& LuminanceReadback);
+// Skipped for pixel formats other than PF_FloatRGBA and PF_A32B32G32R32F
+void AddWil21SkyReadbackPass(FRDGBuilder& GraphBuilder, FRDGTextureRef SkyTexture, const FShaderControlData& ShaderControlData, FWil21SkyReadback& SkyReadback);
+// Moves the finished readbacks, in generation order, to SkyReadback.Completed without waiting for the GPU
+void PollWil21SkyReadback(FWil21SkyReadback& SkyReadback);
+
+// GPU time and luminance error against a CPU reference of the fp64 [0] and double-float [1] sky shaders
+struct FWil21Df64Comparison
+{
+	float Milliseconds[2] = { 0.0f, 0.0f };
+	float MaxRelativeError[2] = { 0.0f, 0.0f };
+	float MeanRelativeError[2] = { 0.0f, 0.0f };
+};
+// Decodes RawDataRad in both formats, renders a TextureSize panorama Iterations times with each and reads it back for comparison
+// with Reference (row major); below SM6 only the double-float entries are filled. Waits for the GPU, for validation only.
+FWil21Df64Comparison CompareWil21Df64(FRHICommandListImmediate& RHIImmCmdList, const FShaderPackedData& ShaderPackedData, const TArray<uint32>& RawDataRad,
+	const FShaderControlData& ShaderControlData, FIntPoint TextureSize, int32 Iterations, TConstArrayView<FLinearColor> Reference);
 ////////////////////// Util functions //////////////////////
 TArray<float> ConvertToFloat(const TArray<double>& DoubleArray);
 FRDGBufferRef CreateRawBuffer(FRDGBuilder& GraphBuilder, const TCHAR* Name, const TArray<float>& Data);
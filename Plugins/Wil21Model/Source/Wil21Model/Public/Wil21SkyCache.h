@@ -0,0 +1,68 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Wil21Rendering.h"
+
+// Quantised controls and output of one generated sky, skies with the same key are treated as identical
+struct FWil21SkyCacheKey
+{
+	int32 SolarElevation = 0;
+	int32 SolarAzimuth = 0;
+	int32 Albedo = 0;
+	int32 Visibility = 0;
+	int32 Altitude = 0;
+	bool bSkyViewLUT = false;
+	FIntPoint Extent = FIntPoint::ZeroValue;
+	EPixelFormat Format = PF_Unknown;
+
+	bool operator==(const FWil21SkyCacheKey& Other) const
+	{
+		return SolarElevation == Other.SolarElevation && SolarAzimuth == Other.SolarAzimuth && Albedo == Other.Albedo && Visibility == Other.Visibility
+			&& Altitude == Other.Altitude && bSkyViewLUT == Other.bSkyViewLUT && Extent == Other.Extent && Format == Other.Format;
+	}
+
+	friend uint32 GetTypeHash(const FWil21SkyCacheKey& Key)
+	{
+		uint32 Hash = HashCombine(GetTypeHash(Key.SolarElevation), GetTypeHash(Key.SolarAzimuth));
+		Hash = HashCombine(Hash, HashCombine(GetTypeHash(Key.Albedo), GetTypeHash(Key.Visibility)));
+		Hash = HashCombine(Hash, HashCombine(GetTypeHash(Key.Altitude), GetTypeHash(Key.Extent)));
+		return HashCombine(Hash, HashCombine(GetTypeHash(Key.bSkyViewLUT), GetTypeHash(Key.Format)));
+	}
+};
+
+/**
+ * Least recently used full resolution skies of one output, kept as pooled render targets within r.Wil21.SkyCache.BudgetMB.
+ * Entries belong to the coefficient buffer they were generated with, a new buffer (e.g. streamed altitude slices) empties the cache.
+ * Render thread only.
+ */
+class WIL21MODEL_API FWil21SkyCache
+{
+public:
+	~FWil21SkyCache();
+
+	/** Quantises Control with the r.Wil21.SkyCache.* steps. */
+	static FWil21SkyCacheKey MakeKey(const FShaderControlData& Control, FIntPoint Extent, EPixelFormat Format);
+	static bool IsEnabled();
+
+	/** Returns the sky generated for Key with DataRad and marks it as most recently used, null on a miss. */
+	TRefCountPtr<IPooledRenderTarget> Find(const FWil21SkyCacheKey& Key, const TRefCountPtr<FRDGPooledBuffer>& DataRad);
+	/** Keeps Sky for Key, evicting the least recently used entries beyond the budget. */
+	void Add(const FWil21SkyCacheKey& Key, const TRefCountPtr<FRDGPooledBuffer>& DataRad, TRefCountPtr<IPooledRenderTarget> Sky);
+	void Empty();
+
+private:
+	struct FEntry
+	{
+		TRefCountPtr<IPooledRenderTarget> Sky;
+		int64 Bytes = 0;
+		uint64 LastUsed = 0;
+	};
+
+	void SetDataRad(const TRefCountPtr<FRDGPooledBuffer>& InDataRad);
+	void EvictToBudget(int64 BudgetBytes);
+
+	TMap<FWil21SkyCacheKey, FEntry> Entries;
+	TRefCountPtr<FRDGPooledBuffer> DataRad;
+	int64 TotalBytes = 0;
+	uint64 UseCounter = 0;
+};
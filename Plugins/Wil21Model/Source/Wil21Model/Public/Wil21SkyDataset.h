@@ -0,0 +1,53 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "DatProcessor.h"
+#include "Serialization/BulkData.h"
+#include "UObject/Object.h"
+#include "Wil21SkyDataset.generated.h"
+
+class IBulkDataIORequest;
+
+// Called on the game thread; the packed data is empty (DataRadSize == 0) when a slice failed to load
+using FWil21OnSlicesLoaded = TFunction<void(FSkyModelData& SkyModelData, FShaderPackedData& ShaderPackedData)>;
+
+/**
+ * A .dat dataset imported as an asset. The radiance coefficients are kept as bulk data, one payload per
+ * visibility/altitude slice, so a cooked build streams only the slices it needs through the package I/O path.
+ */
+UCLASS(BlueprintType)
+class WIL21MODEL_API UWil21SkyDataset : public UObject
+{
+	GENERATED_BODY()
+public:
+	virtual void Serialize(FArchive& Ar) override;
+
+#if WITH_EDITOR
+	/** Copies the raw slices and transmittance block of a .dat file into this asset. */
+	bool ImportFromFile(const FString& FilePath);
+#endif
+
+	/** Reads the slices bracketing SingleVisibility/SingleAltitude (<= 0 / < 0 for all of them) without blocking.
+	 * With bDecodeCoefficients the thread pool also decodes them into DataRad for a CPU evaluator. */
+	void LoadSlicesAsync(double SingleVisibility, double SingleAltitude, FWil21OnSlicesLoaded OnLoaded, bool bDecodeCoefficients = false);
+
+	/** Blocking variant for the CPU evaluator, decodes the same slices into OutRadiance.DataRad without packing them for the GPU. */
+	bool LoadSlices(double SingleVisibility, double SingleAltitude, FRadianceData& OutRadiance, TArray<uint32>* OutRawDataRad = nullptr);
+
+	bool HasTransmittance() const { return TransmittanceData.RankTrans > 0; }
+
+	UPROPERTY(VisibleAnywhere, Category = "Wil21Model")
+	FString SourceFile;
+
+	// Radiance metadata, DataRad stays empty
+	FRadianceData Header;
+
+	UPROPERTY()
+	FTransmittanceData TransmittanceData;
+
+private:
+	int32 GetSliceIndex(int32 Visibility, int32 Altitude) const { return Visibility * Header.AltitudesInFile.Num() + Altitude; }
+
+	// [Visibility][Altitude], each holding the configs of every albedo, albedo major
+	TIndirectArray<FByteBulkData> Slices;
+};
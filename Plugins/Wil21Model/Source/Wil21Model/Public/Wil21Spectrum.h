@@ -0,0 +1,20 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+// CIE 1931 colour matching functions, sampled every 5 nm starting at 360 nm.
+#define WIL21_SPECTRAL_RESPONSE_START 360.0
+#define WIL21_SPECTRAL_RESPONSE_STEP 5.0
+#define WIL21_SPECTRAL_RESPONSE_COUNT 95
+
+namespace Wil21Spectrum
+{
+	/** Centre wavelength (nm) of a model channel. */
+	double GetChannelWavelength(int32 Channel, double ChannelStart, double ChannelWidth);
+
+	/**
+	 * Linear sRGB contribution of one unit of radiance in every model channel, already scaled by the channel width.
+	 * Summing Radiance[c] * Weights[c] over all channels gives the same colour as the old per-pixel shader conversion.
+	 */
+	TArray<FVector3d> ComputeChannelToRGB(int32 Channels, double ChannelStart, double ChannelWidth);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "DatProcessor.h"
+
+/**
+ * Sun transmittance (top of atmosphere to observer) precomputed from the rank-decomposed transmittance factors.
+ * Indexed by solar elevation, visibility and observer altitude, so the sun colour can be looked up every frame
+ * without evaluating the transmittance model.
+ */
+struct FWil21SunTransmittanceLUT
+{
+	/** Builds the table from loaded transmittance data. Leaves the table empty if no transmittance block was read. */
+	void Build(const FSkyModelData& SkyModelData, int32 InElevationCount = 64);
+
+	bool IsValid() const { return Colors.Num() > 0; }
+
+	/** Linear colour of sunlight after passing through the atmosphere, white sun at the top of the atmosphere. */
+	FLinearColor Sample(double SolarElevationDeg, double Visibility, double Altitude) const;
+
+	/** Transmittance of a single channel along a ray, as fitted by the model. Distance <= 0 means up to the atmosphere edge. */
+	static double EvaluateTransmittance(const FTransmittanceData& TransmittanceData, int32 Channels, int32 Channel, double Theta, double Distance, double Visibility, double Altitude);
+
+private:
+	FLinearColor Fetch(int32 AltitudeIdx, int32 VisibilityIdx, int32 ElevationIdx) const;
+
+	int32 ElevationCount = 0;
+	double ElevationMin = 0.0;
+	double ElevationMax = 0.0;
+	TArray<double> Visibilities;
+	TArray<double> Altitudes;
+	// [Altitude][Visibility][Elevation]
+	TArray<FLinearColor> Colors;
+};
@@ -0,0 +1,22 @@
+#include "Wil21SkyDatasetFactory.h"
+#include "Wil21SkyDataset.h"
+
+UWil21SkyDatasetFactory::UWil21SkyDatasetFactory()
+{
+	SupportedClass = UWil21SkyDataset::StaticClass();
+	bCreateNew = false;
+	bEditorImport = true;
+	Formats.Add(TEXT("dat;Wil21 sky model dataset"));
+}
+
+UObject* UWil21SkyDatasetFactory::FactoryCreateFile(UClass* InClass, UObject* InParent, FName InName, EObjectFlags Flags, const FString& Filename, const TCHAR* Parms, FFeedbackContext* Warn, bool& bOutOperationCanceled)
+{
+	bOutOperationCanceled = false;
+	UWil21SkyDataset* Dataset = NewObject<UWil21SkyDataset>(InParent, InClass, InName, Flags);
+	if (!Dataset->ImportFromFile(Filename))
+	{
+		Warn->Logf(ELogVerbosity::Error, TEXT("Failed to import sky model dataset %s"), *Filename);
+		return nullptr;
+	}
+	return Dataset;
+}
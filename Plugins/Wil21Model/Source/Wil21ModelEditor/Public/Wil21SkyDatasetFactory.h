@@ -0,0 +1,16 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Factories/Factory.h"
+#include "Wil21SkyDatasetFactory.generated.h"
+
+/** Imports a .dat sky model dataset as a UWil21SkyDataset asset. */
+UCLASS()
+class UWil21SkyDatasetFactory : public UFactory
+{
+	GENERATED_BODY()
+public:
+	UWil21SkyDatasetFactory();
+
+	virtual UObject* FactoryCreateFile(UClass* InClass, UObject* InParent, FName InName, EObjectFlags Flags, const FString& Filename, const TCHAR* Parms, FFeedbackContext* Warn, bool& bOutOperationCanceled) override;
+};
@@ -0,0 +1,20 @@
+using UnrealBuildTool;
+
+public class Wil21ModelEditor : ModuleRules
+{
+	public Wil21ModelEditor(ReadOnlyTargetRules Target) : base(Target)
+	{
+		PCHUsage = ModuleRules.PCHUsageMode.UseExplicitOrSharedPCHs;
+
+		PrivateDependencyModuleNames.AddRange(
+			new string[]
+			{
+				"Core",
+				"CoreUObject",
+				"Engine",
+				"UnrealEd",
+				"Wil21Model",
+			}
+			);
+	}
+}